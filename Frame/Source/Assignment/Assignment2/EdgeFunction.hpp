@@ -0,0 +1,194 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <eigen3/Eigen/Eigen>
+#include "Simd.hpp"
+
+namespace rst
+{
+    // Barycentric coordinates of a screen space triangle written as plane equations,
+    // set up once per triangle and evaluated for 8 horizontally adjacent pixel centers at once.
+    //
+    //   beta(x, y)  = beta_dx  * (x - x0) + beta_dy  * (y - y0)
+    //   gamma(x, y) = gamma_dx * (x - x0) + gamma_dy * (y - y0)
+    //   alpha       = 1 - beta - gamma
+    //
+    // (x0, y0) is the first vertex. A pixel is covered when all three weights are positive,
+    // which works for both windings.
+    struct edge_equations
+    {
+        float x0, y0;
+        float beta_dx, beta_dy;
+        float gamma_dx, gamma_dy;
+
+        // Per row terms, see row().
+        struct row_terms
+        {
+            float beta, gamma;
+        };
+
+        // Barycentrics and coverage of 8 pixels, bit i of mask is lane i.
+        struct block
+        {
+            simd::float8 alpha, beta, gamma;
+            int mask;
+        };
+
+        // Returns false for degenerate triangles, which cover no pixel.
+        bool setup(const Eigen::Vector4f* v)
+        {
+            x0 = v[0].x();
+            y0 = v[0].y();
+            float e1x = v[1].x() - x0, e1y = v[1].y() - y0;
+            float e2x = v[2].x() - x0, e2y = v[2].y() - y0;
+
+            // Twice the signed area.
+            float area = e1x * e2y - e2x * e1y;
+            if (area == 0.0f || !std::isfinite(area))
+                return false;
+
+            float inv_area = 1.0f / area;
+            beta_dx = e2y * inv_area;
+            beta_dy = -e2x * inv_area;
+            gamma_dx = -e1y * inv_area;
+            gamma_dy = e1x * inv_area;
+            return true;
+        }
+
+        // offset_y / offset_x give the sample position inside the pixel, the center by default.
+        row_terms row(int y, float offset_y = 0.5f) const
+        {
+            float dy = (float)y + offset_y - y0;
+            return {beta_dy * dy, gamma_dy * dy};
+        }
+
+        // x must be a multiple of 8, so every pixel is always evaluated in the same lane
+        // and gives the same result no matter which tile or bounding box it is visited from.
+        block evaluate(int x, const row_terms& r, float offset_x = 0.5f) const
+        {
+            simd::float8 dx = simd::float8((float)x + offset_x - x0) + simd::float8::lanes();
+
+            block b;
+            b.beta = simd::float8(beta_dx) * dx + simd::float8(r.beta);
+            b.gamma = simd::float8(gamma_dx) * dx + simd::float8(r.gamma);
+            b.alpha = simd::float8(1.0f) - b.beta - b.gamma;
+
+            simd::float8 zero(0.0f);
+            b.mask = simd::greater(b.alpha, zero) & simd::greater(b.beta, zero) & simd::greater(b.gamma, zero);
+            return b;
+        }
+    };
+
+    // Same interface as edge_equations, but watertight and deterministic: the vertices are snapped to a
+    // grid of 1/256 pixel and coverage comes from exact integer edge functions
+    //
+    //   E_i(x, y) = a_i * x + b_i * y + c_i
+    //
+    // for the edge opposite vertex i, scaled so that they are positive inside for both windings.
+    // Samples exactly on an edge belong to the triangle for which it is a top or left edge (with y up),
+    // so two triangles sharing an edge never both cover, nor both miss, a sample on it.
+    // The barycentrics handed on to interpolation are E_i / area in float.
+    struct fixed_edge_equations
+    {
+        static constexpr int SUBPIXEL_BITS = 8;
+        static constexpr int64_t ONE = int64_t(1) << SUBPIXEL_BITS;
+        // Larger coordinates could overflow the 64 bit edge functions, such triangles are skipped.
+        static constexpr float MAX_COORDINATE = 1 << 20;
+
+        int64_t a[3], b[3], c[3];
+        // -1 for top-left edges, which also own the samples with E == 0, otherwise 0.
+        int64_t threshold[3];
+        float inv_area;
+
+        struct row_terms
+        {
+            int64_t e[3];
+        };
+
+        using block = edge_equations::block;
+
+        static int64_t snap(float v) { return std::llround(v * (float)ONE); }
+        static int64_t snap_offset(float offset) { return std::lround(offset * (float)ONE); }
+
+        bool setup(const Eigen::Vector4f* v)
+        {
+            int64_t x[3], y[3];
+            for (int i = 0; i < 3; ++i)
+            {
+                if (!(std::abs(v[i].x()) <= MAX_COORDINATE && std::abs(v[i].y()) <= MAX_COORDINATE))
+                    return false;
+                x[i] = snap(v[i].x());
+                y[i] = snap(v[i].y());
+            }
+
+            // Twice the signed area in subpixel units, positive for counter clockwise triangles.
+            const int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+            if (area == 0)
+                return false;
+            const int64_t sign = area > 0 ? 1 : -1;
+
+            for (int i = 0; i < 3; ++i)
+            {
+                const int j = (i + 1) % 3, k = (i + 2) % 3;
+                a[i] = sign * (y[j] - y[k]);
+                b[i] = sign * (x[k] - x[j]);
+                c[i] = -(a[i] * x[j] + b[i] * y[j]);
+
+                // With the interior on the left, the edge runs along (b, -a): a left edge points down,
+                // a top edge points left.
+                const bool top_left = a[i] > 0 || (a[i] == 0 && b[i] < 0);
+                threshold[i] = top_left ? -1 : 0;
+            }
+
+            inv_area = 1.0f / (float)(area * sign);
+            return true;
+        }
+
+        // offset_y / offset_x give the sample position inside the pixel, the center by default.
+        row_terms row(int y, float offset_y = 0.5f) const
+        {
+            const int64_t sy = y * ONE + snap_offset(offset_y);
+            return {{b[0] * sy + c[0], b[1] * sy + c[1], b[2] * sy + c[2]}};
+        }
+
+        // x must be a multiple of 8, see edge_equations::evaluate.
+        block evaluate(int x, const row_terms& r, float offset_x = 0.5f) const
+        {
+            const int64_t sx = x * ONE + snap_offset(offset_x);
+            simd::float8 weights[3];
+            int mask = (1 << simd::WIDTH) - 1;
+
+            for (int i = 0; i < 3; ++i)
+            {
+                const int64_t step = a[i] * ONE;
+                const int64_t e = r.e[i] + a[i] * sx;
+                int covered = 0;
+                for (int lane = 0; lane < simd::WIDTH; ++lane)
+                    covered |= (e + step * lane > threshold[i]) << lane;
+                mask &= covered;
+
+                // Only coverage needs to be exact.
+                weights[i] = simd::float8((float)e * inv_area) + simd::float8::lanes() * simd::float8((float)step * inv_area);
+            }
+
+            block result;
+            result.alpha = weights[0];
+            result.beta = weights[1];
+            result.gamma = weights[2];
+            result.mask = mask;
+            return result;
+        }
+    };
+
+    // Lanes of the 8 pixel block starting at x which lie inside [begin, end).
+    inline int span_mask(int x, int begin, int end)
+    {
+        int lo = std::max(begin - x, 0);
+        int hi = std::min(end - x, simd::WIDTH);
+        if (lo >= hi)
+            return 0;
+        return ((1 << hi) - 1) & ~((1 << lo) - 1);
+    }
+}
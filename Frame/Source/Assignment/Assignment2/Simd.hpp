@@ -0,0 +1,125 @@
+#pragma once
+
+// Thin 8-wide float wrapper used by the rasterizer inner loops.
+// AVX2 builds use one 256 bit register, SSE builds use two 128 bit registers,
+// anything else falls back to plain scalar loops.
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SIMD_SSE 1
+#endif
+
+#include <algorithm>
+
+namespace simd
+{
+    constexpr int WIDTH = 8;
+
+#if defined(SIMD_AVX2)
+
+    struct float8
+    {
+        __m256 v;
+
+        float8() = default;
+        float8(__m256 x) : v(x) {}
+        explicit float8(float x) : v(_mm256_set1_ps(x)) {}
+
+        static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+        void store(float* p) const { _mm256_storeu_ps(p, v); }
+        // 0, 1, ..., 7
+        static float8 lanes() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    };
+
+    inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+    inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+    inline float8 min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+    inline float8 max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+
+    // Comparisons return one bit per lane, bit i is lane i.
+    inline int greater(float8 a, float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+    inline int less(float8 a, float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+
+#elif defined(SIMD_SSE)
+
+    struct float8
+    {
+        __m128 lo, hi;
+
+        float8() = default;
+        float8(__m128 l, __m128 h) : lo(l), hi(h) {}
+        explicit float8(float x) : lo(_mm_set1_ps(x)), hi(_mm_set1_ps(x)) {}
+
+        static float8 load(const float* p) { return {_mm_loadu_ps(p), _mm_loadu_ps(p + 4)}; }
+        void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+        static float8 lanes() { return {_mm_setr_ps(0, 1, 2, 3), _mm_setr_ps(4, 5, 6, 7)}; }
+    };
+
+    inline float8 operator+(float8 a, float8 b) { return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)}; }
+    inline float8 operator-(float8 a, float8 b) { return {_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)}; }
+    inline float8 operator*(float8 a, float8 b) { return {_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)}; }
+    inline float8 operator/(float8 a, float8 b) { return {_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)}; }
+    inline float8 min(float8 a, float8 b) { return {_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)}; }
+    inline float8 max(float8 a, float8 b) { return {_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)}; }
+
+    inline int greater(float8 a, float8 b)
+    {
+        return _mm_movemask_ps(_mm_cmpgt_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmpgt_ps(a.hi, b.hi)) << 4);
+    }
+    inline int less(float8 a, float8 b)
+    {
+        return _mm_movemask_ps(_mm_cmplt_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmplt_ps(a.hi, b.hi)) << 4);
+    }
+
+#else
+
+    struct float8
+    {
+        float v[WIDTH];
+
+        float8() = default;
+        explicit float8(float x) { std::fill(v, v + WIDTH, x); }
+
+        static float8 load(const float* p) { float8 r; std::copy(p, p + WIDTH, r.v); return r; }
+        void store(float* p) const { std::copy(v, v + WIDTH, p); }
+        static float8 lanes() { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = (float)i; return r; }
+    };
+
+    template <typename Op>
+    inline float8 apply(float8 a, float8 b, Op op)
+    {
+        float8 r;
+        for (int i = 0; i < WIDTH; ++i)
+            r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+
+    inline float8 operator+(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+    inline float8 operator-(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+    inline float8 operator*(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+    inline float8 operator/(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+    inline float8 min(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+    inline float8 max(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+
+    inline int greater(float8 a, float8 b)
+    {
+        int mask = 0;
+        for (int i = 0; i < WIDTH; ++i)
+            mask |= (a.v[i] > b.v[i]) << i;
+        return mask;
+    }
+    inline int less(float8 a, float8 b)
+    {
+        int mask = 0;
+        for (int i = 0; i < WIDTH; ++i)
+            mask |= (a.v[i] < b.v[i]) << i;
+        return mask;
+    }
+
+#endif
+}
@@ -42,7 +42,7 @@ int main(int argc, const char** argv)
     bool command_line = false;
     std::string filename = "output.png";
 
-    if (argc == 2)
+    if (argc >= 2)
     {
         command_line = true;
         filename = std::string(argv[1]);
@@ -50,6 +50,17 @@ int main(int argc, const char** argv)
 
     rst::rasterizer r(700, 700);
 
+    // Optional sample count for MSAA, e.g. "output.png 4", and "fixed" for fixed point rasterization,
+    // e.g. "output.png 1 fixed".
+    if (argc >= 3)
+    {
+        r.set_msaa(std::atoi(argv[2]));
+    }
+    if (argc >= 4 && std::string(argv[3]) == "fixed")
+    {
+        r.set_fixed_point(true);
+    }
+
     Eigen::Vector3f eye_pos = {0,0,5};
 
 
@@ -4,8 +4,11 @@
 //
 
 #include <algorithm>
+#include <bit>
+#include <thread>
 #include <vector>
 #include "rasterizer.hpp"
+#include "EdgeFunction.hpp"
 #include <opencv2/opencv.hpp>
 #include <math.h>
 
@@ -39,20 +42,34 @@ auto to_vec4(const Eigen::Vector3f& v3, float w = 1.0f)
     return Vector4f(v3.x(), v3.y(), v3.z(), w);
 }
 
+namespace
+{
+    constexpr int MAX_SAMPLES = 8;
 
-static bool insideTriangle(int x, int y, const Vector3f* _v)
-{   
-    // TODO : Implement this function to check if the point (x, y) is inside the triangle represented by _v[0], _v[1], _v[2]
-}
+    // Standard 4x and 8x sample positions inside the pixel, in 1/16 of a pixel.
+    constexpr int SAMPLES_4X[4][2] = {{6, 2}, {14, 6}, {2, 10}, {10, 14}};
+    constexpr int SAMPLES_8X[8][2] = {{9, 5}, {7, 11}, {13, 9}, {5, 3}, {3, 13}, {1, 7}, {11, 15}, {15, 1}};
 
-static std::tuple<float, float, float> computeBarycentric2D(float x, float y, const Vector3f* v)
-{
-    float c1 = (x*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*y + v[1].x()*v[2].y() - v[2].x()*v[1].y()) / (v[0].x()*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*v[0].y() + v[1].x()*v[2].y() - v[2].x()*v[1].y());
-    float c2 = (x*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*y + v[2].x()*v[0].y() - v[0].x()*v[2].y()) / (v[1].x()*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*v[1].y() + v[2].x()*v[0].y() - v[0].x()*v[2].y());
-    float c3 = (x*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*y + v[0].x()*v[1].y() - v[1].x()*v[0].y()) / (v[2].x()*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*v[2].y() + v[0].x()*v[1].y() - v[1].x()*v[0].y());
-    return {c1,c2,c3};
+    // Pixels [x_begin, x_end) x [y_begin, y_end) which may be covered by the triangle, clamped to the screen.
+    struct pixel_bounds
+    {
+        int x_begin, x_end, y_begin, y_end;
+
+        pixel_bounds(const std::array<Eigen::Vector4f, 3>& v, int width, int height)
+        {
+            float min_x = std::floor(std::min({v[0].x(), v[1].x(), v[2].x()}));
+            float max_x = std::ceil(std::max({v[0].x(), v[1].x(), v[2].x()}));
+            float min_y = std::floor(std::min({v[0].y(), v[1].y(), v[2].y()}));
+            float max_y = std::ceil(std::max({v[0].y(), v[1].y(), v[2].y()}));
+            x_begin = (int)std::max(0.0f, min_x);
+            x_end = (int)std::min((float)width, max_x + 1.0f);
+            y_begin = (int)std::max(0.0f, min_y);
+            y_end = (int)std::min((float)height, max_y + 1.0f);
+        }
+    };
 }
 
+
 void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type)
 {
     auto& buf = pos_buf[pos_buffer.pos_id];
@@ -98,24 +115,278 @@ void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf
         t.setColor(1, col_y[0], col_y[1], col_y[2]);
         t.setColor(2, col_z[0], col_z[1], col_z[2]);
 
-        rasterize_triangle(t);
+        if (msaa_samples > 1)
+            fixed_point ? rasterize_triangle_msaa<fixed_edge_equations>(t) : rasterize_triangle_msaa<edge_equations>(t);
+        else
+            fixed_point ? rasterize_triangle<fixed_edge_equations>(t) : rasterize_triangle<edge_equations>(t);
     }
+
+    if (msaa_samples > 1)
+        resolve_samples();
 }
 
 //Screen space rasterization
+template <typename Edges>
 void rst::rasterizer::rasterize_triangle(const Triangle& t) {
     auto v = t.toVector4();
-    
-    // TODO : Find out the bounding box of current triangle.
-    // iterate through the pixel and find if the current pixel is inside the triangle
 
-    // If so, use the following code to get the interpolated z value.
-    //auto[alpha, beta, gamma] = computeBarycentric2D(x, y, t.v);
-    //float w_reciprocal = 1.0/(alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-    //float z_interpolated = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-    //z_interpolated *= w_reciprocal;
+    Edges edges;
+    if (!edges.setup(v.data()))
+        return;
+
+    // Bounding box of the triangle, clamped to the screen.
+    const auto [x_begin, x_end, y_begin, y_end] = pixel_bounds(v, width, height);
+
+    const simd::float8 inv_w0(1.0f / v[0].w()), inv_w1(1.0f / v[1].w()), inv_w2(1.0f / v[2].w());
+    const simd::float8 z_w0(v[0].z() / v[0].w()), z_w1(v[1].z() / v[1].w()), z_w2(v[2].z() / v[2].w());
+    float z_interpolated[simd::WIDTH];
+
+    for (int y = y_begin; y < y_end; ++y)
+    {
+        const auto row = edges.row(y);
+        for (int x = x_begin & ~(simd::WIDTH - 1); x < x_end; x += simd::WIDTH)
+        {
+            auto b = edges.evaluate(x, row);
+            int mask = b.mask & span_mask(x, x_begin, x_end);
+            if (!mask)
+                continue;
+
+            simd::float8 w_reciprocal = b.alpha * inv_w0 + b.beta * inv_w1 + b.gamma * inv_w2;
+            ((b.alpha * z_w0 + b.beta * z_w1 + b.gamma * z_w2) / w_reciprocal).store(z_interpolated);
+
+            for (; mask; mask &= mask - 1)
+            {
+                const int lane = std::countr_zero((unsigned)mask);
+                const int ind = get_index(x + lane, y);
+                if (z_interpolated[lane] >= depth_buf[ind])
+                    continue;
+
+                depth_buf[ind] = z_interpolated[lane];
+                set_pixel(Eigen::Vector3f(x + lane, y, 1.0f), t.getColor());
+            }
+        }
+    }
+}
+
+// Same as rasterize_triangle, but coverage and depth are tested per sample.
+// The triangle color is computed once per pixel and written to the samples which passed.
+template <typename Edges>
+void rst::rasterizer::rasterize_triangle_msaa(const Triangle& t) {
+    auto v = t.toVector4();
+
+    Edges edges;
+    if (!edges.setup(v.data()))
+        return;
+
+    const auto [x_begin, x_end, y_begin, y_end] = pixel_bounds(v, width, height);
+
+    // After the homogeneous division depth is linear in screen space, one plane gives it at every sample.
+    msaa_triangle tri;
+    tri.color = t.getColor();
+    tri.x0 = v[0].x();
+    tri.y0 = v[0].y();
+    tri.z0 = v[0].z();
+    const Eigen::Vector3f e1 = (v[1] - v[0]).head<3>(), e2 = (v[2] - v[0]).head<3>();
+    const float area = e1.x() * e2.y() - e2.x() * e1.y();
+    tri.dz_dx = (e1.z() * e2.y() - e2.z() * e1.y()) / area;
+    tri.dz_dy = (e1.x() * e2.z() - e2.x() * e1.z()) / area;
+    const uint32_t id = (uint32_t)msaa_triangles.size();
+    msaa_triangles.push_back(tri);
+    if (y_begin < y_end)
+    {
+        dirty_rows_begin = std::min(dirty_rows_begin, height - y_end);
+        dirty_rows_end = std::max(dirty_rows_end, height - y_begin);
+    }
+
+    int covered[MAX_SAMPLES];
+    typename Edges::row_terms rows[MAX_SAMPLES];
+
+    for (int y = y_begin; y < y_end; ++y)
+    {
+        for (int s = 0; s < msaa_samples; ++s)
+            rows[s] = edges.row(y, sample_y[s]);
+
+        for (int x = x_begin & ~(simd::WIDTH - 1); x < x_end; x += simd::WIDTH)
+        {
+            const int x_mask = span_mask(x, x_begin, x_end);
+            int any = 0;
+            for (int s = 0; s < msaa_samples; ++s)
+            {
+                covered[s] = edges.evaluate(x, rows[s], sample_x[s]).mask & x_mask;
+                any |= covered[s];
+            }
+
+            for (; any; any &= any - 1)
+            {
+                const int lane = std::countr_zero((unsigned)any);
+                unsigned samples = 0;
+                for (int s = 0; s < msaa_samples; ++s)
+                    samples |= (covered[s] >> lane & 1u) << s;
+                write_samples(get_index(x + lane, y), x + lane, y, id, samples);
+            }
+        }
+    }
+}
+
+float rst::rasterizer::sample_depth_of(const msaa_pixel& p, int s, int x, int y) const
+{
+    if (p.block >= 0)
+        return sample_depth[p.block + s];
+    if (!(p.coverage >> s & 1) || p.triangle < depth_base)
+        return std::numeric_limits<float>::infinity();
+    return msaa_triangles[p.triangle].depth(x + sample_x[s], y + sample_y[s]);
+}
+
+Eigen::Vector3f rst::rasterizer::sample_color_of(const msaa_pixel& p, int s) const
+{
+    if (p.block >= 0)
+        return sample_colors[p.block + s];
+    if (!(p.coverage >> s & 1) || p.triangle < color_base)
+        return Eigen::Vector3f::Zero();
+    return msaa_triangles[p.triangle].color;
+}
+
+// Depth tests the covered samples of pixel (x, y) against triangle and stores those which pass.
+void rst::rasterizer::write_samples(int ind, int x, int y, uint32_t triangle, unsigned covered)
+{
+    msaa_pixel& p = msaa_pixels[ind];
+    const msaa_triangle& t = msaa_triangles[triangle];
+
+    float depth[MAX_SAMPLES];
+    unsigned passed = 0;
+    for (unsigned mask = covered; mask; mask &= mask - 1)
+    {
+        const int s = std::countr_zero(mask);
+        depth[s] = t.depth(x + sample_x[s], y + sample_y[s]);
+        if (depth[s] < sample_depth_of(p, s, x, y))
+            passed |= 1u << s;
+    }
+    if (!passed)
+        return;
+
+    if (p.block < 0)
+    {
+        // The pixel stays compressed if the new triangle hides every sample of the old one.
+        const bool cleared = p.triangle == msaa_pixel::NONE || (p.triangle < color_base && p.triangle < depth_base);
+        if (cleared || (p.coverage & ~passed) == 0)
+        {
+            p.triangle = triangle;
+            p.coverage = (uint8_t)passed;
+            return;
+        }
+
+        int block;
+        if (free_blocks.empty())
+        {
+            block = (int)sample_colors.size();
+            sample_colors.resize(sample_colors.size() + msaa_samples);
+            sample_depth.resize(sample_depth.size() + msaa_samples);
+        }
+        else
+        {
+            block = free_blocks.back();
+            free_blocks.pop_back();
+        }
+        for (int s = 0; s < msaa_samples; ++s)
+        {
+            sample_depth[block + s] = sample_depth_of(p, s, x, y);
+            sample_colors[block + s] = sample_color_of(p, s);
+        }
+        p.block = block;
+    }
+
+    for (unsigned mask = passed; mask; mask &= mask - 1)
+    {
+        const int s = std::countr_zero(mask);
+        sample_depth[p.block + s] = depth[s];
+        sample_colors[p.block + s] = t.color;
+    }
 
-    // TODO : set the current pixel (use the set_pixel function) to the color of the triangle (use getColor function) if it should be painted.
+    // Fully covered, the pixel is compressed again.
+    if (passed == (1u << msaa_samples) - 1)
+    {
+        free_blocks.push_back(p.block);
+        p.block = -1;
+        p.triangle = triangle;
+        p.coverage = (uint8_t)passed;
+    }
+}
+
+// Averages the samples of every pixel in the rows drawn to since the last resolve into the frame buffer,
+// rows are split between threads.
+void rst::rasterizer::resolve_samples()
+{
+    const int rows_begin = dirty_rows_begin, rows = dirty_rows_end - dirty_rows_begin;
+    dirty_rows_begin = height;
+    dirty_rows_end = 0;
+    if (rows <= 0)
+        return;
+
+    const int workers = std::max(1, (int)std::thread::hardware_concurrency());
+    auto work = [&](int worker)
+    {
+        const int end = (rows_begin + rows * (worker + 1) / workers) * width;
+        for (int ind = (rows_begin + rows * worker / workers) * width; ind < end; ++ind)
+        {
+            const msaa_pixel& p = msaa_pixels[ind];
+            if (p.block < 0)
+            {
+                // Covered samples share the triangle color, the others are black.
+                const int count = std::popcount(p.coverage);
+                const Eigen::Vector3f color = count ? sample_color_of(p, std::countr_zero(p.coverage)) : Eigen::Vector3f::Zero();
+                if (count == 0 || count == msaa_samples)
+                {
+                    frame_buf[ind] = color;
+                    continue;
+                }
+                Eigen::Vector3f sum = color;
+                for (int s = 1; s < count; ++s)
+                    sum += color;
+                frame_buf[ind] = sum / (float)msaa_samples;
+                continue;
+            }
+
+            const Eigen::Vector3f first = sample_color_of(p, 0);
+            Eigen::Vector3f sum = first;
+            bool uniform = true;
+            for (int s = 1; s < msaa_samples; ++s)
+            {
+                const Eigen::Vector3f color = sample_color_of(p, s);
+                uniform &= color == first;
+                sum += color;
+            }
+            // Pixels inside a triangle keep its exact color.
+            frame_buf[ind] = uniform ? first : sum / (float)msaa_samples;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 1; i < workers; ++i)
+        pool.emplace_back(work, i);
+    work(0);
+    for (auto& thread : pool)
+        thread.join();
+}
+
+void rst::rasterizer::set_msaa(int samples)
+{
+    msaa_samples = samples >= 8 ? 8 : samples >= 4 ? 4 : 1;
+
+    const int (*pattern)[2] = msaa_samples == 8 ? SAMPLES_8X : SAMPLES_4X;
+    for (int s = 0; s < msaa_samples; ++s)
+    {
+        sample_x[s] = pattern[s][0] / 16.0f;
+        sample_y[s] = pattern[s][1] / 16.0f;
+    }
+
+    msaa_pixels.assign(msaa_samples > 1 ? width * height : 0, msaa_pixel{msaa_pixel::NONE, -1, 0});
+    dirty_rows_begin = 0;
+    dirty_rows_end = height;
+    msaa_triangles.clear();
+    color_base = depth_base = 0;
+    sample_depth.clear();
+    sample_colors.clear();
+    free_blocks.clear();
 }
 
 void rst::rasterizer::set_model(const Eigen::Matrix4f& m)
@@ -135,13 +406,29 @@ void rst::rasterizer::set_projection(const Eigen::Matrix4f& p)
 
 void rst::rasterizer::clear(rst::Buffers buff)
 {
+    // MSAA pixels owned by a triangle drawn before the clear read as cleared, see color_base and depth_base.
+    const uint32_t drawn = (uint32_t)msaa_triangles.size();
     if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
     {
         std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{0, 0, 0});
+        std::fill(sample_colors.begin(), sample_colors.end(), Eigen::Vector3f{0, 0, 0});
+        color_base = drawn;
     }
     if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
     {
         std::fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+        std::fill(sample_depth.begin(), sample_depth.end(), std::numeric_limits<float>::infinity());
+        depth_base = drawn;
+    }
+    // Nothing drawn is left, start over.
+    if (color_base == drawn && depth_base == drawn && msaa_samples > 1)
+    {
+        std::fill(msaa_pixels.begin(), msaa_pixels.end(), msaa_pixel{msaa_pixel::NONE, -1, 0});
+        msaa_triangles.clear();
+        color_base = depth_base = 0;
+        sample_depth.clear();
+        sample_colors.clear();
+        free_blocks.clear();
     }
 }
 
@@ -6,6 +6,7 @@
 
 #include <eigen3/Eigen/Eigen>
 #include <algorithm>
+#include <cstdint>
 #include "global.hpp"
 #include "Triangle.hpp"
 using namespace Eigen;
@@ -68,6 +69,17 @@ namespace rst
 
         void set_pixel(const Eigen::Vector3f& point, const Eigen::Vector3f& color);
 
+        // Multisample anti-aliasing with 1 (off), 4 or 8 samples per pixel. Every triangle is shaded once
+        // per pixel. A pixel stores which of its samples one triangle covers, depth and color are only
+        // stored per sample for pixels where triangles meet. draw() resolves the samples into the frame
+        // buffer on all hardware threads.
+        void set_msaa(int samples);
+
+        // Snaps vertices to 1/256 pixel and tests coverage with exact integer edge functions and the
+        // top-left rule, see fixed_edge_equations. Shared edges are then watertight and the output
+        // doesn't depend on the compiler's float code generation.
+        void set_fixed_point(bool enabled) { fixed_point = enabled; }
+
         void clear(Buffers buff);
 
         void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
@@ -77,7 +89,38 @@ namespace rst
     private:
         void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
 
+        // Edges is edge_equations or fixed_edge_equations.
+        template <typename Edges>
         void rasterize_triangle(const Triangle& t);
+        template <typename Edges>
+        void rasterize_triangle_msaa(const Triangle& t);
+        void write_samples(int ind, int x, int y, uint32_t triangle, unsigned covered);
+        void resolve_samples();
+
+        struct msaa_triangle
+        {
+            Eigen::Vector3f color;
+            // Screen space depth plane through (x0, y0, z0).
+            float x0, y0, z0;
+            float dz_dx, dz_dy;
+
+            float depth(float x, float y) const { return z0 + dz_dx * (x - x0) + dz_dy * (y - y0); }
+        };
+
+        struct msaa_pixel
+        {
+            static constexpr uint32_t NONE = 0xffffffff;
+
+            // Index into msaa_triangles of the triangle covering the samples in coverage, the other
+            // samples still hold the clear values.
+            uint32_t triangle;
+            // Offset of the pixel's samples in sample_depth and sample_colors, -1 while it is compressed.
+            int block;
+            uint8_t coverage;
+        };
+
+        float sample_depth_of(const msaa_pixel& p, int s, int x, int y) const;
+        Eigen::Vector3f sample_color_of(const msaa_pixel& p, int s) const;
 
         // VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
@@ -95,6 +138,24 @@ namespace rst
         std::vector<float> depth_buf;
         int get_index(int x, int y);
 
+        bool fixed_point = false;
+
+        // MSAA. A compressed pixel is a coverage mask and the triangle owning it, the depth of a covered
+        // sample comes from that triangle's depth plane. A pixel touched by a second triangle that doesn't
+        // cover all samples of the first gets a block of msaa_samples depths and colors.
+        int msaa_samples = 1;
+        float sample_x[8], sample_y[8];
+        std::vector<msaa_pixel> msaa_pixels;
+        // Triangles drawn since the last clear of both buffers. Those before color_base were drawn before
+        // the last color clear and count as black, those before depth_base as infinitely far away.
+        std::vector<msaa_triangle> msaa_triangles;
+        uint32_t color_base = 0, depth_base = 0;
+        // Frame buffer rows which need to be resolved, clears keep frame_buf up to date themselves.
+        int dirty_rows_begin = 0, dirty_rows_end = 0;
+        std::vector<float> sample_depth;
+        std::vector<Eigen::Vector3f> sample_colors;
+        std::vector<int> free_blocks;
+
         int width, height;
 
         int next_id = 0;
@@ -0,0 +1,177 @@
+#include "Batch.hpp"
+
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+// The pattern goes straight to snprintf, so allow at most one conversion and require it to take an int.
+bool valid_pattern(const std::string& pattern)
+{
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        if (pattern[i] != '%')
+            continue;
+        if (i + 1 < pattern.size() && pattern[i + 1] == '%')
+        {
+            ++i;
+            continue;
+        }
+        size_t end = pattern.find_first_not_of("0123456789-+ #", i + 1);
+        if (end == std::string::npos || (pattern[end] != 'd' && pattern[end] != 'i'))
+            return false;
+        ++conversions;
+        i = end;
+    }
+    return conversions <= 1;
+}
+}
+
+void render_options::apply(rst::rasterizer& r) const
+{
+    r.set_tile_rendering(tiled);
+    r.set_deferred_shading(deferred);
+    r.set_cull_mode(cull);
+    r.set_fixed_point(fixed_point);
+}
+
+bool parse_render_option(const std::string& word, render_options& options)
+{
+    if (word == "tiled")
+        options.tiled = true;
+    else if (word == "deferred")
+        options.deferred = true;
+    else if (word == "cull=back")
+        options.cull = rst::CullMode::Back;
+    else if (word == "cull=front")
+        options.cull = rst::CullMode::Front;
+    else if (word == "cull=none")
+        options.cull = rst::CullMode::None;
+    else if (word == "fixed")
+        options.fixed_point = true;
+    else
+        return false;
+    return true;
+}
+
+int render_job::frame_count() const
+{
+    if (angle_step == 0)
+        return 1;
+    float steps = (last_angle - first_angle) / angle_step;
+    return steps < 0 ? 0 : (int)std::floor(steps + 1e-4f) + 1;
+}
+
+std::string render_job::output_path(int frame) const
+{
+    char path[1024];
+    std::snprintf(path, sizeof(path), output_pattern.c_str(), frame);
+    return path;
+}
+
+bool load_render_jobs(const std::string& path, std::vector<render_job>& jobs)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Cannot open job list " << path << "\n";
+        return false;
+    }
+
+    std::vector<render_job> result;
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); ++line_number)
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+
+        render_job job;
+        std::istringstream fields(line);
+        if (!(fields >> job.shader >> job.first_angle >> job.last_angle >> job.angle_step >> job.output_pattern) ||
+            !valid_pattern(job.output_pattern))
+        {
+            std::cerr << path << ":" << line_number << ": expected <shader> <first angle> <last angle> <angle step> <output pattern>\n";
+            return false;
+        }
+        // imwrite picks the encoder by extension and throws on one it doesn't know, which the writer thread
+        // can't handle with exceptions off, so reject the pattern before anything is rendered.
+        if (!cv::haveImageWriter(job.output_path(0)))
+        {
+            std::cerr << path << ":" << line_number << ": no image format for " << job.output_pattern << "\n";
+            return false;
+        }
+        for (std::string word; fields >> word;)
+        {
+            if (!parse_render_option(word, job.options))
+            {
+                std::cerr << path << ":" << line_number << ": unknown option " << word << "\n";
+                return false;
+            }
+        }
+        result.push_back(std::move(job));
+    }
+
+    jobs = std::move(result);
+    return true;
+}
+
+image_writer::image_writer(size_t max_pending) : max_pending(std::max<size_t>(1, max_pending))
+{
+    thread = std::thread([this] { run(); });
+}
+
+image_writer::~image_writer()
+{
+    finish();
+}
+
+void image_writer::push(std::string path, cv::Mat image)
+{
+    std::unique_lock lock(mutex);
+    not_full.wait(lock, [this] { return pending.size() < max_pending; });
+    pending.push_back({std::move(path), std::move(image)});
+    not_empty.notify_one();
+}
+
+size_t image_writer::finish()
+{
+    {
+        std::lock_guard lock(mutex);
+        done = true;
+    }
+    not_empty.notify_one();
+    if (thread.joinable())
+        thread.join();
+    return failed;
+}
+
+void image_writer::run()
+{
+    for (;;)
+    {
+        item next;
+        {
+            std::unique_lock lock(mutex);
+            not_empty.wait(lock, [this] { return done || !pending.empty(); });
+            if (pending.empty())
+                return;
+            next = std::move(pending.front());
+            pending.pop_front();
+        }
+        not_full.notify_one();
+
+        // load_render_jobs only accepts paths with an encoder, so imwrite reports failures by its result.
+        if (!cv::imwrite(next.path, next.image))
+        {
+            std::cerr << "Failed to write " << next.path << "\n";
+            ++failed;
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+// Batch rendering helpers: the job list format and the thread that encodes finished frames.
+//
+// A job list is a text file with one job per line, blank lines and lines starting with '#' are skipped:
+//
+//     <shader> <first angle> <last angle> <angle step> <output pattern>   [options...]
+//     phong    0             359          1            turntable/phong_%03d.png tiled
+//
+// The output pattern is a printf format that receives the frame index within the job, its extension picks
+// the image format. The options that follow it are render_options words.
+
+#include <opencv2/core.hpp>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "rasterizer.hpp"
+
+// Rasterizer modes that can be picked per job or on the command line, see rst::rasterizer for what they do.
+// Each one is named by a word:
+//     tiled                    set_tile_rendering
+//     deferred                 set_deferred_shading
+//     cull=<back|front|none>   set_cull_mode
+//     fixed                    set_fixed_point
+struct render_options
+{
+    bool tiled = false;
+    bool deferred = false;
+    rst::CullMode cull = rst::CullMode::None;
+    bool fixed_point = false;
+
+    void apply(rst::rasterizer& r) const;
+};
+
+// Returns false if word names no option.
+bool parse_render_option(const std::string& word, render_options& options);
+
+struct render_job
+{
+    std::string shader;
+    float first_angle = 0;
+    float last_angle = 0;
+    float angle_step = 1;
+    std::string output_pattern;
+    render_options options;
+
+    int frame_count() const;
+    float angle(int frame) const { return first_angle + angle_step * frame; }
+    std::string output_path(int frame) const;
+};
+
+// Returns false and leaves jobs untouched if the file can't be read or a line is malformed.
+bool load_render_jobs(const std::string& path, std::vector<render_job>& jobs);
+
+// Encodes and writes images on its own thread, so PNG compression doesn't stall the render workers.
+// push() blocks while max_pending images are waiting, which bounds the memory held by finished frames.
+class image_writer
+{
+public:
+    explicit image_writer(size_t max_pending);
+    ~image_writer();
+
+    image_writer(const image_writer&) = delete;
+    image_writer& operator=(const image_writer&) = delete;
+
+    // The image is written as is, pass a clone if the caller reuses its buffer.
+    void push(std::string path, cv::Mat image);
+
+    // Waits until every pushed image is on disk. Returns the number of images that failed to write.
+    size_t finish();
+
+private:
+    void run();
+
+    struct item
+    {
+        std::string path;
+        cv::Mat image;
+    };
+
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<item> pending;
+    size_t max_pending;
+    size_t failed = 0;
+    bool done = false;
+    std::thread thread;
+};
@@ -0,0 +1,1135 @@
+#pragma once
+
+// Fast backend for objl::Loader.
+//
+// Loader::LoadFile reads the file with std::getline and splits every line and face corner into
+// std::strings before std::stof sees them. FastLoader memory maps the file and parses numbers with
+// std::from_chars straight from the mapping, without allocating per token. Large files are cut into
+// chunks at line boundaries, which are parsed in parallel:
+//
+//     1. count the v, vt and vn lines of every chunk, so each chunk knows where its data goes,
+//     2. parse positions, texture coordinates and normals into the shared arrays and faces into corner lists,
+//     3. build the vertices of every face and triangulate it,
+//     4. replay the o, g, usemtl and mtllib lines in file order and copy the chunks into meshes.
+//
+// The result is the same LoadedMeshes, LoadedVertices, LoadedIndices and LoadedMaterials as Loader::LoadFile,
+// including its splitting of meshes at o, g and usemtl lines, so switching only needs the loader type changed.
+//
+// StreamFile runs the same passes over one piece of the file at a time and hands the vertices and triangles of
+// each piece to a MeshStream, so callers can build their own structures without the loader keeping a copy.
+//
+// After parsing, the result is saved to a binary cache next to the file, see MeshCache.hpp. Later loads of an
+// unchanged file copy the arrays straight out of the mapped cache instead of parsing the text. StreamFile writes
+// the cache while it parses, so it doesn't need the whole result in memory either.
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include "MappedFile.hpp"
+#include "MeshCache.hpp"
+#include "OBJ_Loader.h"
+
+namespace objl
+{
+    namespace fast
+    {
+        // Chunks are at least this large, small files are parsed on the calling thread.
+        constexpr size_t MIN_CHUNK_BYTES = 1 << 20;
+
+        enum class LineType
+        {
+            Other,
+            Position,
+            TexCoord,
+            Normal,
+            Face,
+            Group,
+            UseMaterial,
+            MaterialLibrary
+        };
+
+        // Face corner with 0 based indices into the positions, texture coordinates and normals of the file.
+        // Missing or invalid indices are negative.
+        struct Corner
+        {
+            int Position;
+            int TexCoord;
+            int Normal;
+        };
+
+        // An o, g, usemtl or mtllib line. Its position in the face stream is kept to replay it in order.
+        struct Statement
+        {
+            LineType Type;
+            // Group lines only: whether the first token is o or g, Loader also treats any line starting with 'g' as a group.
+            bool Named;
+            std::string_view Line;
+            // Faces of the chunk before this line.
+            size_t Face;
+            // Vertices and indices of the chunk before this line, set by BuildVertices.
+            size_t Vertex = 0;
+            size_t Index = 0;
+        };
+
+        struct Chunk
+        {
+            std::string_view Text;
+
+            // Number of v, vt and vn lines in this chunk and in all chunks before it.
+            size_t Counts[3] = {};
+            size_t Bases[3] = {};
+
+            std::vector<Corner> Corners;
+            // One past the last corner of each face.
+            std::vector<size_t> FaceEnds;
+            std::vector<Statement> Statements;
+
+            // One vertex per face corner, and the triangles with indices into Vertices.
+            std::vector<Vertex> Vertices;
+            std::vector<unsigned int> Indices;
+        };
+
+        // Next line starting at pos without its line break, pos moves to the following line.
+        inline std::string_view NextLine(std::string_view text, size_t& pos)
+        {
+            size_t end = text.find('\n', pos);
+            if (end == std::string_view::npos)
+                end = text.size();
+            std::string_view line = text.substr(pos, end - pos);
+            pos = end + 1;
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            return line;
+        }
+
+        // Same as algorithm::tail.
+        inline std::string_view Tail(std::string_view line)
+        {
+            size_t tokenStart = line.find_first_not_of(" \t");
+            size_t spaceStart = line.find_first_of(" \t", tokenStart);
+            size_t tailStart = line.find_first_not_of(" \t", spaceStart);
+            size_t tailEnd = line.find_last_not_of(" \t");
+            if (tailStart == std::string_view::npos || tailEnd == std::string_view::npos)
+                return {};
+            return line.substr(tailStart, tailEnd - tailStart + 1);
+        }
+
+        // Same as algorithm::firstToken, rest is the text after the token.
+        inline std::string_view FirstToken(std::string_view line, std::string_view& rest)
+        {
+            size_t start = std::min(line.find_first_not_of(" \t"), line.size());
+            size_t end = std::min(line.find_first_of(" \t", start), line.size());
+            rest = line.substr(end);
+            return line.substr(start, end - start);
+        }
+
+        // Line type by its first token, as compared by Loader::LoadFile.
+        inline LineType Classify(std::string_view line, std::string_view& rest)
+        {
+            std::string_view token = FirstToken(line, rest);
+            if (token.empty())
+                return LineType::Other;
+
+            if (token == "v")
+                return LineType::Position;
+            if (token == "vt")
+                return LineType::TexCoord;
+            if (token == "vn")
+                return LineType::Normal;
+            if (token == "f")
+                return LineType::Face;
+            if (token == "o" || token == "g" || line[0] == 'g')
+                return LineType::Group;
+            if (token == "usemtl")
+                return LineType::UseMaterial;
+            if (token == "mtllib")
+                return LineType::MaterialLibrary;
+            return LineType::Other;
+        }
+
+        inline const char* SkipSpaces(const char* p, const char* end)
+        {
+            while (p != end && (*p == ' ' || *p == '\t'))
+                ++p;
+            return p;
+        }
+
+        inline const char* ParseFloat(const char* p, const char* end, float& value)
+        {
+            p = SkipSpaces(p, end);
+            if (p != end && *p == '+')
+                ++p;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec == std::errc())
+                return result.ptr;
+
+            // std::stof would have failed as well, skip the token.
+            value = 0.0f;
+            while (p != end && *p != ' ' && *p != '\t')
+                ++p;
+            return p;
+        }
+
+        // One index of a face corner. count is the number of elements defined before the face, which negative indices are relative to.
+        inline int ParseIndex(const char*& p, const char* end, size_t count)
+        {
+            int value = 0;
+            auto result = std::from_chars(p, end, value);
+            if (result.ec != std::errc() || value == 0)
+                return -1;
+            p = result.ptr;
+            long long index = value < 0 ? (long long)count + value : (long long)value - 1;
+            return index >= 0 && index <= INT32_MAX ? (int)index : -1;
+        }
+
+        // First pass: number of v, vt and vn lines.
+        inline void CountElements(Chunk& chunk)
+        {
+            for (size_t pos = 0; pos < chunk.Text.size();)
+            {
+                std::string_view rest;
+                switch (Classify(NextLine(chunk.Text, pos), rest))
+                {
+                    case LineType::Position: ++chunk.Counts[0]; break;
+                    case LineType::TexCoord: ++chunk.Counts[1]; break;
+                    case LineType::Normal: ++chunk.Counts[2]; break;
+                    default: break;
+                }
+            }
+        }
+
+        // Second pass: elements go to the shared arrays at the chunk's bases, faces and statements stay in the chunk.
+        inline void ParseChunk(Chunk& chunk, Vector3* positions, Vector2* texCoords, Vector3* normals)
+        {
+            size_t counts[3] = {chunk.Bases[0], chunk.Bases[1], chunk.Bases[2]};
+
+            for (size_t pos = 0; pos < chunk.Text.size();)
+            {
+                std::string_view line = NextLine(chunk.Text, pos);
+                std::string_view rest;
+                LineType type = Classify(line, rest);
+                const char* p = rest.data();
+                const char* end = p + rest.size();
+
+                switch (type)
+                {
+                    case LineType::Position:
+                    {
+                        Vector3& v = positions[counts[0]++];
+                        p = ParseFloat(p, end, v.X);
+                        p = ParseFloat(p, end, v.Y);
+                        ParseFloat(p, end, v.Z);
+                        break;
+                    }
+                    case LineType::TexCoord:
+                    {
+                        Vector2& vt = texCoords[counts[1]++];
+                        p = ParseFloat(p, end, vt.X);
+                        ParseFloat(p, end, vt.Y);
+                        break;
+                    }
+                    case LineType::Normal:
+                    {
+                        Vector3& vn = normals[counts[2]++];
+                        p = ParseFloat(p, end, vn.X);
+                        p = ParseFloat(p, end, vn.Y);
+                        ParseFloat(p, end, vn.Z);
+                        break;
+                    }
+                    case LineType::Face:
+                    {
+                        // v, v/vt, v//vn or v/vt/vn
+                        for (p = SkipSpaces(p, end); p != end; p = SkipSpaces(p, end))
+                        {
+                            Corner c = {ParseIndex(p, end, counts[0]), -1, -1};
+                            if (p != end && *p == '/')
+                            {
+                                c.TexCoord = ParseIndex(++p, end, counts[1]);
+                                if (p != end && *p == '/')
+                                    c.Normal = ParseIndex(++p, end, counts[2]);
+                            }
+                            while (p != end && *p != ' ' && *p != '\t')
+                                ++p;
+                            chunk.Corners.push_back(c);
+                        }
+                        chunk.FaceEnds.push_back(chunk.Corners.size());
+                        break;
+                    }
+                    case LineType::Group:
+                    case LineType::UseMaterial:
+                    case LineType::MaterialLibrary:
+                    {
+                        std::string_view token = FirstToken(line, rest);
+                        chunk.Statements.push_back({type, token == "o" || token == "g", line, chunk.FaceEnds.size()});
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+        }
+
+        // Third pass: the vertices of every face, as Loader::GenVerticesFromRawOBJ makes them, and its triangles.
+        inline void BuildVertices(Chunk& chunk, const std::vector<Vector3>& positions, const std::vector<Vector2>& texCoords, const std::vector<Vector3>& normals)
+        {
+            chunk.Vertices.reserve(chunk.Corners.size());
+            chunk.Indices.reserve(chunk.Corners.size() * 3 / 2);
+
+            std::vector<Vertex> polygon;
+            std::vector<unsigned int> polygonIndices;
+            size_t statement = 0;
+            size_t first = 0;
+
+            for (size_t face = 0; face < chunk.FaceEnds.size(); ++face)
+            {
+                for (; statement < chunk.Statements.size() && chunk.Statements[statement].Face == face; ++statement)
+                {
+                    chunk.Statements[statement].Vertex = chunk.Vertices.size();
+                    chunk.Statements[statement].Index = chunk.Indices.size();
+                }
+
+                const size_t last = chunk.FaceEnds[face];
+                const size_t base = chunk.Vertices.size();
+                bool noNormal = false;
+                for (size_t i = first; i < last; ++i)
+                {
+                    const Corner& c = chunk.Corners[i];
+                    Vertex v;
+                    if (c.Position >= 0 && (size_t)c.Position < positions.size())
+                        v.Position = positions[c.Position];
+                    if (c.TexCoord >= 0 && (size_t)c.TexCoord < texCoords.size())
+                        v.TextureCoordinate = texCoords[c.TexCoord];
+                    if (c.Normal >= 0 && (size_t)c.Normal < normals.size())
+                        v.Normal = normals[c.Normal];
+                    else
+                        noNormal = true;
+                    chunk.Vertices.push_back(v);
+                }
+                const size_t count = last - first;
+                first = last;
+
+                Vertex* faceVertices = chunk.Vertices.data() + base;
+                if (noNormal && count >= 3)
+                {
+                    Vector3 normal = math::CrossV3(faceVertices[0].Position - faceVertices[1].Position, faceVertices[2].Position - faceVertices[1].Position);
+                    for (size_t i = 0; i < count; ++i)
+                        faceVertices[i].Normal = normal;
+                }
+
+                if (count == 3)
+                {
+                    chunk.Indices.push_back((unsigned int)base);
+                    chunk.Indices.push_back((unsigned int)base + 1);
+                    chunk.Indices.push_back((unsigned int)base + 2);
+                }
+                else if (count > 3)
+                {
+                    polygon.assign(faceVertices, faceVertices + count);
+                    polygonIndices.clear();
+                    Loader::VertexTriangluation(polygonIndices, polygon);
+                    for (unsigned int i : polygonIndices)
+                        chunk.Indices.push_back((unsigned int)base + i);
+                }
+            }
+
+            for (; statement < chunk.Statements.size(); ++statement)
+            {
+                chunk.Statements[statement].Vertex = chunk.Vertices.size();
+                chunk.Statements[statement].Index = chunk.Indices.size();
+            }
+        }
+
+        // Runs task(i) for i in [0, count), each on its own thread and the first one on the calling thread.
+        template <typename Task>
+        void ParallelFor(size_t count, const Task& task)
+        {
+            std::vector<std::thread> workers;
+            for (size_t i = 1; i < count; ++i)
+                workers.emplace_back([&task, i] { task(i); });
+            if (count > 0)
+                task(0);
+            for (auto& worker : workers)
+                worker.join();
+        }
+
+        // What Loader::LoadFile remembers from line to line: the current mesh name and the materials.
+        struct ReplayState
+        {
+            bool listening = false;
+            std::string meshname;
+            std::vector<std::string> MeshMatNames;
+            std::vector<Material> Materials;
+            // The .mtl files named by mtllib lines.
+            std::vector<std::string> MaterialFiles;
+
+            // Index into Materials of the i-th mesh's material, -1 if none.
+            // Loader matches meshes and usemtl lines by their order, not by position in the file.
+            int MeshMaterial(size_t i) const
+            {
+                for (size_t j = 0; i < MeshMatNames.size() && j < Materials.size(); j++)
+                {
+                    if (Materials[j].name == MeshMatNames[i])
+                        return (int)j;
+                }
+                return -1;
+            }
+        };
+
+        // Fourth pass: replays the faces and the o, g, usemtl and mtllib lines of a chunk in file order, splitting
+        // meshes as Loader::LoadFile does. The sink takes
+        //
+        //     AddFaces(chunk, vertexBegin, vertexEnd, indexBegin, indexEnd)   the chunk's faces between two lines,
+        //     HasMesh()                                                        whether the current mesh has triangles,
+        //     EndMesh(name)                                                    the current mesh is complete.
+        template <typename Sink>
+        void Replay(const Chunk& chunk, const std::string& Path, ReplayState& state, Sink& sink)
+        {
+            size_t vertex = 0, index = 0;
+            for (const Statement& statement : chunk.Statements)
+            {
+                sink.AddFaces(chunk, vertex, statement.Vertex, index, statement.Index);
+                vertex = statement.Vertex;
+                index = statement.Index;
+                const bool hasMesh = sink.HasMesh();
+
+                switch (statement.Type)
+                {
+                    case LineType::Group:
+                        if (state.listening && hasMesh)
+                        {
+                            sink.EndMesh(state.meshname);
+                            state.meshname = Tail(statement.Line);
+                        }
+                        else
+                        {
+                            state.meshname = statement.Named ? std::string(Tail(statement.Line)) : "unnamed";
+                        }
+                        state.listening = true;
+                        break;
+                    case LineType::UseMaterial:
+                        state.MeshMatNames.emplace_back(Tail(statement.Line));
+                        // Loader names every mesh split off by a material change like this.
+                        if (hasMesh)
+                            sink.EndMesh(state.meshname + "_2");
+                        break;
+                    case LineType::MaterialLibrary:
+                    {
+                        size_t slash = Path.rfind('/');
+                        std::string pathtomat = slash == std::string::npos ? "" : Path.substr(0, slash + 1);
+                        pathtomat += Tail(statement.Line);
+                        state.MaterialFiles.push_back(pathtomat);
+
+                        Loader materials;
+                        materials.LoadMaterials(pathtomat);
+                        state.Materials.insert(state.Materials.end(), materials.LoadedMaterials.begin(), materials.LoadedMaterials.end());
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+            sink.AddFaces(chunk, vertex, chunk.Vertices.size(), index, chunk.Indices.size());
+        }
+    }
+
+    // Class: MeshStream
+    //
+    // Description: Receives a file from FastLoader::StreamFile
+    //	while it's parsed. Vertices and triangles arrive in batches
+    //	and belong to the current mesh until EndMesh. Indices count
+    //	from the first vertex of the mesh and only refer to vertices
+    //	that were already passed in. The pointers are only valid
+    //	during the call.
+    class MeshStream
+    {
+    public:
+        virtual ~MeshStream() = default;
+
+        // The next vertices of the current mesh
+        virtual void AddVertices(const Vertex* vertices, size_t count) = 0;
+        // The next triangles of the current mesh, 3 indices each
+        virtual void AddIndices(const unsigned int* indices, size_t count) = 0;
+        // The current mesh is complete, material is null if it has none.
+        //	LoadFile pairs meshes and usemtl lines by their order, a
+        //	material named after the end of its mesh is not known yet
+        //	and null as well. Vertices without triangles at the end of
+        //	the file belong to no mesh, as with LoadFile
+        virtual void EndMesh(const std::string&, const Material*) {}
+    };
+
+    // Class: FastLoader
+    //
+    // Description: Drop in replacement for Loader with a
+    //	memory mapped, allocation free and parallel parser
+    class FastLoader
+    {
+    public:
+        // Load a file into the loader, see Loader::LoadFile
+        //
+        // threads is the most worker threads to parse with,
+        // 0 uses one per hardware thread
+        bool LoadFile(const std::string& Path, unsigned int threads = 0)
+        {
+            LoadedFromCache = false;
+            if (Path.size() < 4 || Path.substr(Path.size() - 4, 4) != ".obj")
+                return false;
+
+            cache::SourceStamp stamp;
+            if (!cache::Stamp(Path, stamp))
+                return false;
+
+            LoadedMeshes.clear();
+            LoadedVertices.clear();
+            LoadedIndices.clear();
+            LoadedMaterials.clear();
+            meshMaterials.clear();
+            materialFiles.clear();
+
+            if (UseCache && ReadCache(Path, stamp))
+            {
+                LoadedFromCache = true;
+                return !(LoadedMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty());
+            }
+
+            MappedFile file;
+            if (!file.Open(Path))
+                return false;
+
+            std::vector<fast::Chunk> chunks = Split(file.View(), threads);
+
+            fast::ParallelFor(chunks.size(), [&](size_t i) { fast::CountElements(chunks[i]); });
+            size_t totals[3] = {};
+            for (auto& chunk : chunks)
+            {
+                for (int k = 0; k < 3; ++k)
+                {
+                    chunk.Bases[k] = totals[k];
+                    totals[k] += chunk.Counts[k];
+                }
+            }
+
+            std::vector<Vector3> positions(totals[0]);
+            std::vector<Vector2> texCoords(totals[1]);
+            std::vector<Vector3> normals(totals[2]);
+            fast::ParallelFor(chunks.size(), [&](size_t i) { fast::ParseChunk(chunks[i], positions.data(), texCoords.data(), normals.data()); });
+            fast::ParallelFor(chunks.size(), [&](size_t i) { fast::BuildVertices(chunks[i], positions, texCoords, normals); });
+
+            Assemble(chunks, Path);
+
+            if (UseCache)
+                WriteCache(Path, stamp, cache::Hash(file.View()));
+
+            return !(LoadedMeshes.empty() && LoadedVertices.empty() && LoadedIndices.empty());
+        }
+
+        // Parse a file into stream instead of the loaded arrays,
+        //	with the same meshes as LoadFile
+        //
+        // Only the positions, texture coordinates and normals of
+        //	the file are kept, since faces may refer to any of them.
+        //	Faces are parsed in pieces of STREAM_BLOCK_BYTES and
+        //	passed on before the next piece. A valid cache is read
+        //	mesh by mesh, otherwise one is written on the way.
+        bool StreamFile(const std::string& Path, MeshStream& stream)
+        {
+            LoadedFromCache = false;
+            if (Path.size() < 4 || Path.substr(Path.size() - 4, 4) != ".obj")
+                return false;
+
+            cache::SourceStamp stamp;
+            if (!cache::Stamp(Path, stamp))
+                return false;
+            if (UseCache && StreamCache(Path, stamp, stream))
+            {
+                LoadedFromCache = true;
+                return true;
+            }
+
+            MappedFile file;
+            if (!file.Open(Path))
+                return false;
+            const std::string_view text = file.View();
+
+            std::vector<Vector3> positions;
+            std::vector<Vector2> texCoords;
+            std::vector<Vector3> normals;
+            fast::ReplayState state;
+            std::optional<CachingStream> caching;
+            if (UseCache)
+                caching.emplace(stream, cache::CachePath(Path, WeldVertices));
+            MeshStreamer sink(caching ? *caching : stream, state, WeldVertices);
+
+            for (size_t begin = 0; begin < text.size();)
+            {
+                size_t end = text.find('\n', std::min(begin + STREAM_BLOCK_BYTES, text.size() - 1));
+                end = end == std::string_view::npos ? text.size() : end + 1;
+
+                fast::Chunk chunk;
+                chunk.Text = text.substr(begin, end - begin);
+                begin = end;
+
+                fast::CountElements(chunk);
+                chunk.Bases[0] = positions.size();
+                chunk.Bases[1] = texCoords.size();
+                chunk.Bases[2] = normals.size();
+                positions.resize(positions.size() + chunk.Counts[0]);
+                texCoords.resize(texCoords.size() + chunk.Counts[1]);
+                normals.resize(normals.size() + chunk.Counts[2]);
+
+                fast::ParseChunk(chunk, positions.data(), texCoords.data(), normals.data());
+                fast::BuildVertices(chunk, positions, texCoords, normals);
+                fast::Replay(chunk, Path, state, sink);
+            }
+            if (sink.HasMesh())
+                sink.EndMesh(state.meshname);
+            if (caching)
+                caching->Finish(stamp, cache::Hash(text), state);
+
+            return sink.MeshCount > 0 || sink.VertexCount > 0;
+        }
+
+        // Size of the pieces StreamFile parses at a time
+        static constexpr size_t STREAM_BLOCK_BYTES = 1 << 20;
+
+        // Store each distinct vertex of a mesh once, see Loader::WeldVertices
+        bool WeldVertices = false;
+        // Read and write the binary cache next to the file
+        bool UseCache = true;
+        // Whether the last LoadFile or StreamFile was served from the cache
+        bool LoadedFromCache = false;
+
+        // Loaded Mesh Objects
+        std::vector<Mesh> LoadedMeshes;
+        // Loaded Vertex Objects
+        std::vector<Vertex> LoadedVertices;
+        // Loaded Index Positions
+        std::vector<unsigned int> LoadedIndices;
+        // Loaded Material Objects
+        std::vector<Material> LoadedMaterials;
+
+    private:
+        // Index into LoadedMaterials for each mesh, -1 if none.
+        std::vector<int> meshMaterials;
+        // The .mtl files named by mtllib lines.
+        std::vector<std::string> materialFiles;
+
+        // Cut text into about one chunk per thread, every chunk ends after a line break.
+        static std::vector<fast::Chunk> Split(std::string_view text, unsigned int threads)
+        {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            size_t count = std::clamp<size_t>(text.size() / fast::MIN_CHUNK_BYTES, 1, threads);
+
+            std::vector<fast::Chunk> chunks;
+            size_t begin = 0;
+            for (size_t i = 1; i <= count && begin < text.size(); ++i)
+            {
+                size_t end = text.size();
+                if (i < count)
+                {
+                    end = text.find('\n', std::max(begin, text.size() / count * i));
+                    end = end == std::string_view::npos ? text.size() : end + 1;
+                }
+                chunks.emplace_back().Text = text.substr(begin, end - begin);
+                begin = end;
+            }
+            return chunks;
+        }
+
+        // Collects the replayed meshes into the loaded arrays.
+        struct MeshBuilder
+        {
+            explicit MeshBuilder(FastLoader& loader) : Loader(loader) {}
+
+            FastLoader& Loader;
+            std::vector<Vertex> Vertices;
+            std::vector<unsigned int> Indices;
+            VertexWelder Welder;
+            std::vector<unsigned int> Welded;
+
+            void AddFaces(const fast::Chunk& chunk, size_t vertex, size_t vertexEnd, size_t index, size_t indexEnd)
+            {
+                std::vector<Vertex>& LoadedVertices = Loader.LoadedVertices;
+                std::vector<unsigned int>& LoadedIndices = Loader.LoadedIndices;
+
+                if (Loader.WeldVertices)
+                {
+                    // Same order of lookups as Loader::LoadFile, so both number the vertices alike.
+                    Welded.resize(vertexEnd - vertex);
+                    for (size_t i = vertex; i < vertexEnd; ++i)
+                    {
+                        size_t count = Vertices.size();
+                        Welded[i - vertex] = Welder.Add(Vertices, chunk.Vertices[i]);
+                        if (Vertices.size() != count)
+                            LoadedVertices.push_back(chunk.Vertices[i]);
+                    }
+
+                    const unsigned int meshStart = (unsigned int)(LoadedVertices.size() - Vertices.size());
+                    for (size_t i = index; i < indexEnd; ++i)
+                    {
+                        Indices.push_back(Welded[chunk.Indices[i] - vertex]);
+                        LoadedIndices.push_back(meshStart + Welded[chunk.Indices[i] - vertex]);
+                    }
+                    return;
+                }
+
+                const size_t meshBase = Vertices.size();
+                const size_t loadedBase = LoadedVertices.size();
+                Vertices.insert(Vertices.end(), chunk.Vertices.begin() + vertex, chunk.Vertices.begin() + vertexEnd);
+                LoadedVertices.insert(LoadedVertices.end(), chunk.Vertices.begin() + vertex, chunk.Vertices.begin() + vertexEnd);
+                for (size_t i = index; i < indexEnd; ++i)
+                {
+                    Indices.push_back((unsigned int)(chunk.Indices[i] - vertex + meshBase));
+                    LoadedIndices.push_back((unsigned int)(chunk.Indices[i] - vertex + loadedBase));
+                }
+            }
+
+            bool HasMesh() const { return !Indices.empty() && !Vertices.empty(); }
+
+            void EndMesh(std::string name)
+            {
+                Mesh tempMesh;
+                tempMesh.Vertices = std::move(Vertices);
+                tempMesh.Indices = std::move(Indices);
+                tempMesh.MeshName = std::move(name);
+                Loader.LoadedMeshes.push_back(std::move(tempMesh));
+                Vertices.clear();
+                Indices.clear();
+                Welder.Clear();
+            }
+        };
+
+        // Passes the replayed meshes on to a MeshStream, one batch per run of faces.
+        struct MeshStreamer
+        {
+            MeshStreamer(MeshStream& stream, const fast::ReplayState& state, bool weld) : Stream(stream), State(state), Weld(weld) {}
+
+            MeshStream& Stream;
+            const fast::ReplayState& State;
+            const bool Weld;
+            // Meshes completed and vertices passed on for the current one
+            size_t MeshCount = 0;
+            size_t VertexCount = 0;
+            bool HasIndices = false;
+
+            VertexWelder Welder;
+            std::vector<unsigned int> Welded;
+            std::vector<Vertex> Vertices;
+            std::vector<unsigned int> Indices;
+
+            void AddFaces(const fast::Chunk& chunk, size_t vertex, size_t vertexEnd, size_t index, size_t indexEnd)
+            {
+                if (vertex == vertexEnd)
+                    return;
+
+                // Indices of a run only refer to its own vertices.
+                Indices.clear();
+                if (Weld)
+                {
+                    Vertices.clear();
+                    Welded.resize(vertexEnd - vertex);
+                    for (size_t i = vertex; i < vertexEnd; ++i)
+                    {
+                        bool added;
+                        Welded[i - vertex] = Welder.Add(chunk.Vertices[i], added);
+                        if (added)
+                            Vertices.push_back(chunk.Vertices[i]);
+                    }
+                    for (size_t i = index; i < indexEnd; ++i)
+                        Indices.push_back(Welded[chunk.Indices[i] - vertex]);
+                    if (!Vertices.empty())
+                        Stream.AddVertices(Vertices.data(), Vertices.size());
+                    VertexCount += Vertices.size();
+                }
+                else
+                {
+                    Stream.AddVertices(chunk.Vertices.data() + vertex, vertexEnd - vertex);
+                    for (size_t i = index; i < indexEnd; ++i)
+                        Indices.push_back((unsigned int)(chunk.Indices[i] - vertex + VertexCount));
+                    VertexCount += vertexEnd - vertex;
+                }
+
+                if (!Indices.empty())
+                {
+                    Stream.AddIndices(Indices.data(), Indices.size());
+                    HasIndices = true;
+                }
+            }
+
+            bool HasMesh() const { return HasIndices && VertexCount > 0; }
+
+            void EndMesh(const std::string& name)
+            {
+                int material = State.MeshMaterial(MeshCount++);
+                Stream.EndMesh(name, material >= 0 ? &State.Materials[material] : nullptr);
+                VertexCount = 0;
+                HasIndices = false;
+                Welder.Clear();
+            }
+        };
+
+        // Passes a stream on and writes everything in it as the cache of the file. Vertices go straight into
+        // the cache, indices into a side file that is appended once the vertex section is complete.
+        class CachingStream : public MeshStream
+        {
+        public:
+            CachingStream(MeshStream& target, const std::string& cachePath)
+                : Target(target)
+                , Writer(cachePath)
+                , IndexPath(cachePath + ".indices.tmp")
+                , IndexFile(IndexPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc)
+            {
+                VertexOffset = Writer.BeginSection();
+            }
+
+            ~CachingStream() override
+            {
+                IndexFile.close();
+                std::error_code error;
+                std::filesystem::remove(IndexPath, error);
+            }
+
+            void AddVertices(const Vertex* vertices, size_t count) override
+            {
+                Target.AddVertices(vertices, count);
+                Writer.Append(vertices, count * sizeof(Vertex));
+                VertexCount += count;
+            }
+
+            void AddIndices(const unsigned int* indices, size_t count) override
+            {
+                Target.AddIndices(indices, count);
+                // The cache holds indices into all vertices, as LoadedIndices.
+                Loaded.resize(count);
+                for (size_t i = 0; i < count; ++i)
+                    Loaded[i] = indices[i] + (uint32_t)FirstVertex;
+                IndexFile.write(reinterpret_cast<const char*>(Loaded.data()), (std::streamsize)(count * sizeof(uint32_t)));
+                IndexCount += count;
+            }
+
+            void EndMesh(const std::string& name, const Material* material) override
+            {
+                Target.EndMesh(name, material);
+                // The material is set in Finish, once all usemtl lines are known.
+                Meshes.push_back({Writer.AddString(name), -1, 0, FirstVertex, VertexCount - FirstVertex, FirstIndex, IndexCount - FirstIndex});
+                FirstVertex = VertexCount;
+                FirstIndex = IndexCount;
+            }
+
+            // Completes the cache after the last mesh. Failing to write only costs the next load a parse.
+            void Finish(const cache::SourceStamp& stamp, uint64_t hash, const fast::ReplayState& state)
+            {
+                cache::Header header = CacheHeader(stamp, hash);
+                header.VertexCount = VertexCount;
+                header.VertexOffset = VertexOffset;
+
+                header.IndexCount = IndexCount;
+                header.IndexOffset = Writer.BeginSection();
+                IndexFile.seekg(0);
+                std::vector<char> block(STREAM_BLOCK_BYTES);
+                for (uint64_t left = IndexCount * sizeof(uint32_t); left > 0;)
+                {
+                    const size_t bytes = (size_t)std::min<uint64_t>(left, block.size());
+                    if (!IndexFile.read(block.data(), (std::streamsize)bytes))
+                        return;
+                    Writer.Append(block.data(), bytes);
+                    left -= bytes;
+                }
+
+                for (size_t i = 0; i < Meshes.size(); ++i)
+                    Meshes[i].Material = state.MeshMaterial(i);
+                FinishCache(Writer, header, Meshes, state.Materials, state.MaterialFiles);
+            }
+
+        private:
+            MeshStream& Target;
+            cache::Writer Writer;
+            std::string IndexPath;
+            std::fstream IndexFile;
+            std::vector<uint32_t> Loaded;
+            std::vector<cache::MeshRecord> Meshes;
+            uint64_t VertexOffset = 0;
+            uint64_t VertexCount = 0, IndexCount = 0;
+            // Start of the current mesh
+            uint64_t FirstVertex = 0, FirstIndex = 0;
+        };
+
+        // Replays the mesh and material statements of Loader::LoadFile over the parsed chunks.
+        void Assemble(std::vector<fast::Chunk>& chunks, const std::string& Path)
+        {
+            size_t vertexCount = 0, indexCount = 0;
+            for (const auto& chunk : chunks)
+            {
+                vertexCount += chunk.Vertices.size();
+                indexCount += chunk.Indices.size();
+            }
+            LoadedVertices.reserve(WeldVertices ? vertexCount / 4 : vertexCount);
+            LoadedIndices.reserve(indexCount);
+
+            fast::ReplayState state;
+            MeshBuilder builder(*this);
+            for (fast::Chunk& chunk : chunks)
+            {
+                fast::Replay(chunk, Path, state, builder);
+
+                // Nothing refers to the chunk's copy any more.
+                chunk.Vertices = {};
+                chunk.Indices = {};
+            }
+            if (builder.HasMesh())
+                builder.EndMesh(state.meshname);
+
+            // Set Materials for each Mesh
+            meshMaterials.resize(LoadedMeshes.size());
+            for (size_t i = 0; i < LoadedMeshes.size(); i++)
+            {
+                meshMaterials[i] = state.MeshMaterial(i);
+                if (meshMaterials[i] >= 0)
+                    LoadedMeshes[i].MeshMaterial = state.Materials[meshMaterials[i]];
+            }
+            LoadedMaterials = std::move(state.Materials);
+            materialFiles = std::move(state.MaterialFiles);
+        }
+
+        // Maps the cache of Path if it's valid for the source stamp. restamp tells whether
+        // the file's new time has to be written back with Restamp once the mapping is closed.
+        bool OpenCache(const std::string& Path, const cache::SourceStamp& stamp, MappedFile& file, cache::Header& header, bool& restamp) const
+        {
+            if (!file.Open(cache::CachePath(Path, WeldVertices)) || file.Size() < sizeof(cache::Header))
+                return false;
+
+            std::memcpy(&header, file.Data(), sizeof(header));
+            if (header.Magic != cache::MAGIC || header.Version != cache::VERSION || header.VertexSize != sizeof(Vertex))
+                return false;
+
+            auto fits = [&](uint64_t offset, uint64_t count, size_t size)
+            {
+                return offset % alignof(std::max_align_t) == 0 && offset <= file.Size() && count <= (file.Size() - offset) / size;
+            };
+            if (!fits(header.VertexOffset, header.VertexCount, sizeof(Vertex)) ||
+                !fits(header.IndexOffset, header.IndexCount, sizeof(uint32_t)) ||
+                !fits(header.MeshOffset, header.MeshCount, sizeof(cache::MeshRecord)) ||
+                !fits(header.MaterialOffset, header.MaterialCount, sizeof(cache::MaterialRecord)) ||
+                !fits(header.DependencyOffset, header.DependencyCount, sizeof(cache::Dependency)) ||
+                !fits(header.StringOffset, header.StringBytes, 1))
+                return false;
+
+            const std::string_view strings(file.Data() + header.StringOffset, header.StringBytes);
+            const auto* dependencies = reinterpret_cast<const cache::Dependency*>(file.Data() + header.DependencyOffset);
+            for (uint64_t i = 0; i < header.DependencyCount; ++i)
+            {
+                cache::SourceStamp current;
+                if (!cache::Stamp(std::string(cache::GetString(strings, dependencies[i].Path)), current))
+                    current = cache::MISSING;
+                if (!(current == dependencies[i].Stamp))
+                    return false;
+            }
+
+            // Same size but touched: compare the content before trusting the cache.
+            restamp = !(header.Source == stamp);
+            if (restamp)
+            {
+                MappedFile source;
+                if (header.Source.Size != stamp.Size || !source.Open(Path) || cache::Hash(source.View()) != header.SourceHash)
+                    return false;
+            }
+
+            const auto* meshes = reinterpret_cast<const cache::MeshRecord*>(file.Data() + header.MeshOffset);
+            for (uint64_t i = 0; i < header.MeshCount; ++i)
+            {
+                const cache::MeshRecord& m = meshes[i];
+                if (m.FirstVertex > header.VertexCount || m.VertexCount > header.VertexCount - m.FirstVertex ||
+                    m.FirstIndex > header.IndexCount || m.IndexCount > header.IndexCount - m.FirstIndex)
+                    return false;
+            }
+            return true;
+        }
+
+        void Restamp(const std::string& Path, const cache::SourceStamp& stamp) const
+        {
+            std::fstream out(cache::CachePath(Path, WeldVertices), std::ios::in | std::ios::out | std::ios::binary);
+            out.seekp(offsetof(cache::Header, Source));
+            out.write(reinterpret_cast<const char*>(&stamp), sizeof(stamp));
+        }
+
+        static std::vector<Material> ReadMaterials(const MappedFile& file, const cache::Header& header)
+        {
+            const std::string_view strings(file.Data() + header.StringOffset, header.StringBytes);
+            const auto* records = reinterpret_cast<const cache::MaterialRecord*>(file.Data() + header.MaterialOffset);
+
+            std::vector<Material> materials(header.MaterialCount);
+            for (uint64_t i = 0; i < header.MaterialCount; ++i)
+            {
+                const cache::MaterialRecord& r = records[i];
+                Material& material = materials[i];
+                material.Ka = Vector3(r.Ka[0], r.Ka[1], r.Ka[2]);
+                material.Kd = Vector3(r.Kd[0], r.Kd[1], r.Kd[2]);
+                material.Ks = Vector3(r.Ks[0], r.Ks[1], r.Ks[2]);
+                material.Ns = r.Ns;
+                material.Ni = r.Ni;
+                material.d = r.d;
+                material.illum = r.illum;
+                material.name = cache::GetString(strings, r.name);
+                material.map_Ka = cache::GetString(strings, r.map_Ka);
+                material.map_Kd = cache::GetString(strings, r.map_Kd);
+                material.map_Ks = cache::GetString(strings, r.map_Ks);
+                material.map_Ns = cache::GetString(strings, r.map_Ns);
+                material.map_d = cache::GetString(strings, r.map_d);
+                material.map_bump = cache::GetString(strings, r.map_bump);
+            }
+            return materials;
+        }
+
+        // Fills the loaded data from the cache of Path if it's valid for the source stamp.
+        bool ReadCache(const std::string& Path, const cache::SourceStamp& stamp)
+        {
+            MappedFile file;
+            cache::Header header;
+            bool restamp;
+            if (!OpenCache(Path, stamp, file, header, restamp))
+                return false;
+
+            const std::string_view strings(file.Data() + header.StringOffset, header.StringBytes);
+            const auto* vertices = reinterpret_cast<const Vertex*>(file.Data() + header.VertexOffset);
+            const auto* indices = reinterpret_cast<const uint32_t*>(file.Data() + header.IndexOffset);
+            const auto* meshes = reinterpret_cast<const cache::MeshRecord*>(file.Data() + header.MeshOffset);
+
+            LoadedVertices.assign(vertices, vertices + header.VertexCount);
+            LoadedIndices.assign(indices, indices + header.IndexCount);
+            LoadedMaterials = ReadMaterials(file, header);
+
+            LoadedMeshes.resize(header.MeshCount);
+            meshMaterials.resize(header.MeshCount);
+            for (uint64_t i = 0; i < header.MeshCount; ++i)
+            {
+                const cache::MeshRecord& r = meshes[i];
+                Mesh& mesh = LoadedMeshes[i];
+                mesh.MeshName = cache::GetString(strings, r.Name);
+                mesh.Vertices.assign(vertices + r.FirstVertex, vertices + r.FirstVertex + r.VertexCount);
+                mesh.Indices.resize(r.IndexCount);
+                for (uint64_t j = 0; j < r.IndexCount; ++j)
+                    mesh.Indices[j] = indices[r.FirstIndex + j] - (unsigned int)r.FirstVertex;
+                meshMaterials[i] = r.Material >= 0 && (uint64_t)r.Material < header.MaterialCount ? r.Material : -1;
+                if (meshMaterials[i] >= 0)
+                    mesh.MeshMaterial = LoadedMaterials[meshMaterials[i]];
+            }
+
+            file.Close();
+            if (restamp)
+                Restamp(Path, stamp);
+            return true;
+        }
+
+        // Passes the meshes of a valid cache on to stream, the vertices straight from the mapping.
+        bool StreamCache(const std::string& Path, const cache::SourceStamp& stamp, MeshStream& stream) const
+        {
+            MappedFile file;
+            cache::Header header;
+            bool restamp;
+            if (!OpenCache(Path, stamp, file, header, restamp))
+                return false;
+
+            const std::string_view strings(file.Data() + header.StringOffset, header.StringBytes);
+            const auto* vertices = reinterpret_cast<const Vertex*>(file.Data() + header.VertexOffset);
+            const auto* indices = reinterpret_cast<const uint32_t*>(file.Data() + header.IndexOffset);
+            const auto* meshes = reinterpret_cast<const cache::MeshRecord*>(file.Data() + header.MeshOffset);
+            const std::vector<Material> materials = ReadMaterials(file, header);
+
+            constexpr size_t BATCH = 3 * 4096;
+            std::vector<unsigned int> batch;
+            for (uint64_t i = 0; i < header.MeshCount; ++i)
+            {
+                const cache::MeshRecord& r = meshes[i];
+                if (r.VertexCount > 0)
+                    stream.AddVertices(vertices + r.FirstVertex, r.VertexCount);
+                for (uint64_t first = 0; first < r.IndexCount; first += BATCH)
+                {
+                    const uint64_t last = std::min<uint64_t>(first + BATCH, r.IndexCount);
+                    batch.resize(last - first);
+                    for (uint64_t j = first; j < last; ++j)
+                        batch[j - first] = indices[r.FirstIndex + j] - (unsigned int)r.FirstVertex;
+                    stream.AddIndices(batch.data(), batch.size());
+                }
+                const bool hasMaterial = r.Material >= 0 && (uint64_t)r.Material < header.MaterialCount;
+                stream.EndMesh(std::string(cache::GetString(strings, r.Name)), hasMaterial ? &materials[r.Material] : nullptr);
+            }
+
+            file.Close();
+            if (restamp)
+                Restamp(Path, stamp);
+            return true;
+        }
+
+        // Saves the loaded data as the cache of Path. Failing to write only costs the next load a parse.
+        void WriteCache(const std::string& Path, const cache::SourceStamp& stamp, uint64_t hash) const
+        {
+            cache::Writer writer(cache::CachePath(Path, WeldVertices));
+            cache::Header header = CacheHeader(stamp, hash);
+
+            // Meshes are consecutive ranges of the loaded vertices and indices.
+            std::vector<cache::MeshRecord> meshes(LoadedMeshes.size());
+            uint64_t firstVertex = 0, firstIndex = 0;
+            for (size_t i = 0; i < LoadedMeshes.size(); ++i)
+            {
+                const Mesh& mesh = LoadedMeshes[i];
+                meshes[i] = {writer.AddString(mesh.MeshName), meshMaterials[i], 0, firstVertex, mesh.Vertices.size(), firstIndex, mesh.Indices.size()};
+                firstVertex += mesh.Vertices.size();
+                firstIndex += mesh.Indices.size();
+            }
+
+            header.VertexCount = LoadedVertices.size();
+            header.VertexOffset = writer.AddSection(LoadedVertices.data(), LoadedVertices.size() * sizeof(Vertex));
+            header.IndexCount = LoadedIndices.size();
+            header.IndexOffset = writer.AddSection(LoadedIndices.data(), LoadedIndices.size() * sizeof(uint32_t));
+            FinishCache(writer, header, meshes, LoadedMaterials, materialFiles);
+        }
+
+        static cache::Header CacheHeader(const cache::SourceStamp& stamp, uint64_t hash)
+        {
+            cache::Header header = {};
+            header.Magic = cache::MAGIC;
+            header.Version = cache::VERSION;
+            header.VertexSize = sizeof(Vertex);
+            header.Source = stamp;
+            header.SourceHash = hash;
+            return header;
+        }
+
+        // Adds the sections after the vertices and indices, which are already written, and moves the cache into place.
+        static void FinishCache(cache::Writer& writer, cache::Header& header, const std::vector<cache::MeshRecord>& meshes,
+                                const std::vector<Material>& loadedMaterials, const std::vector<std::string>& materialFiles)
+        {
+            std::vector<cache::MaterialRecord> materials(loadedMaterials.size());
+            for (size_t i = 0; i < loadedMaterials.size(); ++i)
+            {
+                const Material& m = loadedMaterials[i];
+                materials[i] = {{m.Ka.X, m.Ka.Y, m.Ka.Z}, {m.Kd.X, m.Kd.Y, m.Kd.Z}, {m.Ks.X, m.Ks.Y, m.Ks.Z}, m.Ns, m.Ni, m.d, m.illum,
+                                writer.AddString(m.name), writer.AddString(m.map_Ka), writer.AddString(m.map_Kd), writer.AddString(m.map_Ks),
+                                writer.AddString(m.map_Ns), writer.AddString(m.map_d), writer.AddString(m.map_bump)};
+            }
+
+            std::vector<cache::Dependency> dependencies(materialFiles.size());
+            for (size_t i = 0; i < materialFiles.size(); ++i)
+            {
+                dependencies[i].Path = writer.AddString(materialFiles[i]);
+                if (!cache::Stamp(materialFiles[i], dependencies[i].Stamp))
+                    dependencies[i].Stamp = cache::MISSING;
+            }
+
+            header.MeshCount = meshes.size();
+            header.MeshOffset = writer.AddSection(meshes.data(), meshes.size() * sizeof(cache::MeshRecord));
+            header.MaterialCount = materials.size();
+            header.MaterialOffset = writer.AddSection(materials.data(), materials.size() * sizeof(cache::MaterialRecord));
+            header.DependencyCount = (uint32_t)dependencies.size();
+            header.DependencyOffset = writer.AddSection(dependencies.data(), dependencies.size() * sizeof(cache::Dependency));
+            header.StringBytes = writer.Strings().size();
+            header.StringOffset = writer.AddSection(writer.Strings().data(), writer.Strings().size());
+            writer.Finish(header);
+        }
+    };
+}
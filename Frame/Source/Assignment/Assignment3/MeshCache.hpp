@@ -0,0 +1,224 @@
+#pragma once
+
+// Binary cache of a loaded OBJ file, written by objl::FastLoader next to the source as <file>.obj.cache,
+// or <file>.obj.welded.cache for loads with FastLoader::WeldVertices.
+//
+// The file is a Header followed by sections at 64 byte aligned offsets, so a memory mapping of it can be
+// used in place:
+//
+//     Vertex        vertices[VertexCount]      LoadedVertices
+//     uint32_t      indices[IndexCount]        LoadedIndices
+//     MeshRecord    meshes[MeshCount]          ranges of the two arrays above
+//     MaterialRecord materials[MaterialCount]
+//     Dependency    dependencies[DependencyCount]   .mtl files the materials came from
+//     char          strings[StringBytes]       names and paths, referenced by StringRef
+//
+// A cache is valid while its source has the recorded size and modification time. If only the time differs,
+// e.g. after a checkout or copy, the content hash decides and the new time is written back.
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace objl
+{
+    namespace cache
+    {
+        constexpr uint32_t MAGIC = 0x434a424f; // "OBJC"
+        constexpr uint32_t VERSION = 1;
+        constexpr size_t ALIGNMENT = 64;
+
+        struct StringRef
+        {
+            uint32_t Offset;
+            uint32_t Length;
+        };
+
+        struct SourceStamp
+        {
+            uint64_t Size;
+            int64_t ModifiedTime;
+
+            bool operator==(const SourceStamp&) const = default;
+        };
+
+        // Recorded for a .mtl file that didn't exist, so the cache goes stale once it appears.
+        constexpr SourceStamp MISSING = {~0ull, 0};
+
+        struct Header
+        {
+            uint32_t Magic;
+            uint32_t Version;
+            // sizeof(Vertex), guards against a cache written by a build with a different layout.
+            uint32_t VertexSize;
+            uint32_t DependencyCount;
+
+            SourceStamp Source;
+            uint64_t SourceHash;
+
+            uint64_t VertexCount, VertexOffset;
+            uint64_t IndexCount, IndexOffset;
+            uint64_t MeshCount, MeshOffset;
+            uint64_t MaterialCount, MaterialOffset;
+            uint64_t DependencyOffset;
+            uint64_t StringBytes, StringOffset;
+        };
+
+        struct MeshRecord
+        {
+            StringRef Name;
+            // Index into the materials, -1 if the mesh has none.
+            int32_t Material;
+            uint32_t Padding;
+            uint64_t FirstVertex, VertexCount;
+            // Mesh indices are the loaded indices minus FirstVertex.
+            uint64_t FirstIndex, IndexCount;
+        };
+
+        struct MaterialRecord
+        {
+            float Ka[3], Kd[3], Ks[3];
+            float Ns, Ni, d;
+            int32_t illum;
+            StringRef name, map_Ka, map_Kd, map_Ks, map_Ns, map_d, map_bump;
+        };
+
+        struct Dependency
+        {
+            StringRef Path;
+            SourceStamp Stamp;
+        };
+
+        inline std::string CachePath(const std::string& path, bool welded)
+        {
+            return path + (welded ? ".welded.cache" : ".cache");
+        }
+
+        // Size and modification time, false if the file doesn't exist.
+        inline bool Stamp(const std::string& path, SourceStamp& stamp)
+        {
+            std::error_code error;
+            auto size = std::filesystem::file_size(path, error);
+            if (error)
+                return false;
+            auto time = std::filesystem::last_write_time(path, error);
+            if (error)
+                return false;
+            stamp = {(uint64_t)size, (int64_t)time.time_since_epoch().count()};
+            return true;
+        }
+
+        // 64 bit content hash, 8 bytes per step.
+        inline uint64_t Hash(std::string_view data)
+        {
+            constexpr uint64_t PRIME = 0x100000001b3ull;
+            uint64_t h = 0xcbf29ce484222325ull ^ data.size();
+            size_t i = 0;
+            for (; i + 8 <= data.size(); i += 8)
+            {
+                uint64_t word;
+                std::memcpy(&word, data.data() + i, 8);
+                h = (h ^ word) * PRIME;
+                h ^= h >> 29;
+            }
+            for (; i < data.size(); ++i)
+                h = (h ^ (unsigned char)data[i]) * PRIME;
+            h ^= h >> 32;
+            h *= 0xd6e8feb86659fd93ull;
+            return h ^ (h >> 32);
+        }
+
+        // Writes a cache file section by section, so the data doesn't have to be in memory at once. It goes to
+        // <path>.tmp, which Finish renames over the cache, so a reader never maps a half written file. The file
+        // of a writer that isn't finished is removed.
+        class Writer
+        {
+        public:
+            explicit Writer(const std::string& path)
+                : path(path)
+                , tempPath(path + ".tmp")
+                , out(tempPath, std::ios::binary | std::ios::trunc)
+            {
+                // The header is written last, once all offsets are known.
+                const Header placeholder = {};
+                Append(&placeholder, sizeof(placeholder));
+            }
+
+            ~Writer()
+            {
+                if (finished)
+                    return;
+                out.close();
+                std::error_code error;
+                std::filesystem::remove(tempPath, error);
+            }
+
+            Writer(const Writer&) = delete;
+            Writer& operator=(const Writer&) = delete;
+
+            StringRef AddString(std::string_view s)
+            {
+                StringRef ref = {(uint32_t)strings.size(), (uint32_t)s.size()};
+                strings.append(s);
+                return ref;
+            }
+
+            // Starts a section at the next aligned offset and returns the offset, Append adds to it.
+            uint64_t BeginSection()
+            {
+                static const char zeros[ALIGNMENT] = {};
+                Append(zeros, (ALIGNMENT - size % ALIGNMENT) % ALIGNMENT);
+                return size;
+            }
+
+            void Append(const void* data, size_t bytes)
+            {
+                if (bytes)
+                    out.write(static_cast<const char*>(data), (std::streamsize)bytes);
+                size += bytes;
+            }
+
+            // Appends bytes at the next aligned offset and returns the offset.
+            uint64_t AddSection(const void* data, size_t bytes)
+            {
+                uint64_t offset = BeginSection();
+                Append(data, bytes);
+                return offset;
+            }
+
+            const std::string& Strings() const { return strings; }
+
+            // Writes the header and moves the file into place, false if any write failed.
+            bool Finish(const Header& header)
+            {
+                out.seekp(0);
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                out.close();
+                if (!out)
+                    return false;
+                std::error_code error;
+                std::filesystem::rename(tempPath, path, error);
+                finished = !error;
+                return finished;
+            }
+
+        private:
+            std::string path, tempPath;
+            std::ofstream out;
+            uint64_t size = 0;
+            std::string strings;
+            bool finished = false;
+        };
+
+        inline std::string_view GetString(std::string_view strings, StringRef ref)
+        {
+            if ((uint64_t)ref.Offset + ref.Length > strings.size())
+                return {};
+            return strings.substr(ref.Offset, ref.Length);
+        }
+    }
+}
@@ -0,0 +1,762 @@
+#pragma once
+
+// Template half of the rasterizer: the draw paths and the per pixel loop.
+// It is included at the end of rasterizer.hpp, so draw() can be instantiated
+// with any shader type and the shader call is inlined into the pixel loop.
+
+#include <algorithm>
+#include <atomic>
+#include <barrier>
+#include <bit>
+#include <limits>
+#include <type_traits>
+#include "EdgeFunction.hpp"
+
+namespace rst::detail
+{
+    // Farthest depth of a full HIZ_BLOCK x HIZ_BLOCK block, rows are stride floats apart.
+    inline float block_max(const float* row, int stride)
+    {
+        simd::float8 m = simd::float8::load(row);
+        for (int i = 1; i < rst::HIZ_BLOCK; ++i)
+            m = simd::max(m, simd::float8::load(row + i * stride));
+        return simd::reduce_max(m);
+    }
+
+    // Output of the first pass in deferred shading mode.
+    struct visibility_target
+    {
+        using sample_type = rst::visibility_sample;
+
+        rst::visibility_sample* data;
+
+        void store(int ind, const rst::visibility_sample& s) { data[ind] = s; }
+    };
+
+    // Writes straight into the rasterizer's depth and hierarchical depth buffer and into output,
+    // which is the frame buffer or, in deferred shading mode, the visibility buffer.
+    template <typename Output>
+    struct frame_pixels
+    {
+        using sample_type = typename Output::sample_type;
+
+        Output& output;
+        float* depth_buf;
+        float* hiz_buf;
+        int width, height, blocks_x;
+
+        int index(int x, int y) const { return (height - 1 - y) * width + x; }
+        float& depth(int x, int y) { return depth_buf[index(x, y)]; }
+        void write(int x, int y, const sample_type& c) { output.store(index(x, y), c); }
+
+        float& hiz(int bx, int by) { return hiz_buf[by * blocks_x + bx]; }
+        void update_hiz(int bx, int by)
+        {
+            int x0 = bx * rst::HIZ_BLOCK, y0 = by * rst::HIZ_BLOCK;
+            if (x0 + rst::HIZ_BLOCK <= width && y0 + rst::HIZ_BLOCK <= height)
+            {
+                hiz(bx, by) = block_max(&depth(x0, y0), -width);
+                return;
+            }
+
+            // Partial block on the right or top border of the screen.
+            float m = -std::numeric_limits<float>::infinity();
+            for (int y = y0; y < std::min(y0 + rst::HIZ_BLOCK, height); ++y)
+                for (int x = x0; x < std::min(x0 + rst::HIZ_BLOCK, width); ++x)
+                    m = std::max(m, depth(x, y));
+            hiz(bx, by) = m;
+        }
+    };
+
+    // Color and depth memory of a single tile, owned by one worker while it rasterizes that tile.
+    // Pixels of the tile outside of the screen hold -inf depth, so they never raise a block's farthest depth.
+    template <typename Sample>
+    struct tile_pixels
+    {
+        using sample_type = Sample;
+        static constexpr int BLOCKS = rst::TILE_SIZE / rst::HIZ_BLOCK;
+
+        int x0 = 0, y0 = 0;
+        std::vector<Sample> color = std::vector<Sample>(rst::TILE_SIZE * rst::TILE_SIZE);
+        std::vector<float> depth_buf = std::vector<float>(rst::TILE_SIZE * rst::TILE_SIZE);
+        std::vector<uint8_t> written = std::vector<uint8_t>(rst::TILE_SIZE * rst::TILE_SIZE);
+        float hiz_buf[BLOCKS * BLOCKS];
+
+        int index(int x, int y) const { return (y - y0) * rst::TILE_SIZE + (x - x0); }
+        float& depth(int x, int y) { return depth_buf[index(x, y)]; }
+        void write(int x, int y, const Sample& c)
+        {
+            int ind = index(x, y);
+            color[ind] = c;
+            written[ind] = 1;
+        }
+
+        float& hiz(int bx, int by) { return hiz_buf[(by - y0 / rst::HIZ_BLOCK) * BLOCKS + (bx - x0 / rst::HIZ_BLOCK)]; }
+        void update_hiz(int bx, int by)
+        {
+            hiz(bx, by) = block_max(&depth(bx * rst::HIZ_BLOCK, by * rst::HIZ_BLOCK), rst::TILE_SIZE);
+        }
+    };
+
+    // Twice the signed screen area, positive for counter clockwise triangles.
+    inline float signed_area(const Eigen::Vector4f& a, const Eigen::Vector4f& b, const Eigen::Vector4f& c)
+    {
+        return (b.x() - a.x()) * (c.y() - a.y()) - (c.x() - a.x()) * (b.y() - a.y());
+    }
+
+    // The fragment_shader_payload members Shader reads, see attribute in Shader.hpp.
+    template <typename Shader>
+    constexpr unsigned shader_attributes()
+    {
+        if constexpr (requires { Shader::attributes; })
+            return Shader::attributes;
+        else
+            return attribute::all;
+    }
+
+    // Triangle setup for perspective correct interpolation. 1/w and every attribute divided by w are
+    // linear in screen space, so each is kept as a plane through the first vertex and evaluated for
+    // 8 pixels with one multiply add. A fragment gets its attributes back with one reciprocal of 1/w.
+    struct attribute_planes
+    {
+        enum : int
+        {
+            INV_W,
+            Z_W,
+            COLOR,
+            NORMAL = COLOR + 3,
+            TEX_COORDS = NORMAL + 3,
+            VIEW_POS = TEX_COORDS + 2,
+            COUNT = VIEW_POS + 3
+        };
+
+        // Plane values at the centers of 8 pixels, [plane][lane].
+        using block = float[COUNT][simd::WIDTH];
+
+        float x0, y0;
+        float origin[COUNT], dx[COUNT], dy[COUNT];
+        // Planes of attributes not in here are neither set up nor evaluated, 1/w and z/w always are.
+        unsigned attributes;
+
+        // Returns false for degenerate triangles.
+        bool setup(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos, unsigned used)
+        {
+            const Eigen::Vector4f* v = t.v;
+            x0 = v[0].x();
+            y0 = v[0].y();
+            const float e1x = v[1].x() - x0, e1y = v[1].y() - y0;
+            const float e2x = v[2].x() - x0, e2y = v[2].y() - y0;
+
+            const float area = e1x * e2y - e2x * e1y;
+            if (area == 0.0f || !std::isfinite(area))
+                return false;
+            const float inv_area = 1.0f / area;
+            const float inv_w[3] = {1.0f / v[0].w(), 1.0f / v[1].w(), 1.0f / v[2].w()};
+            attributes = used;
+
+            // Plane through the values f0, f1, f2 at the three vertices.
+            auto plane = [&](int p, float f0, float f1, float f2)
+            {
+                const float d1 = f1 - f0, d2 = f2 - f0;
+                origin[p] = f0;
+                dx[p] = (d1 * e2y - d2 * e1y) * inv_area;
+                dy[p] = (d2 * e1x - d1 * e2x) * inv_area;
+            };
+            auto attribute_plane = [&](int p, const auto* values, int components)
+            {
+                for (int c = 0; c < components; ++c)
+                    plane(p + c, values[0][c] * inv_w[0], values[1][c] * inv_w[1], values[2][c] * inv_w[2]);
+            };
+
+            plane(INV_W, inv_w[0], inv_w[1], inv_w[2]);
+            plane(Z_W, v[0].z() * inv_w[0], v[1].z() * inv_w[1], v[2].z() * inv_w[2]);
+            if (used & attribute::color)
+                attribute_plane(COLOR, t.color, 3);
+            if (used & attribute::normal)
+                attribute_plane(NORMAL, t.normal, 3);
+            if (used & attribute::tex_coords)
+                attribute_plane(TEX_COORDS, t.tex_coords, 2);
+            if (used & attribute::view_pos)
+                attribute_plane(VIEW_POS, view_pos.data(), 3);
+            return true;
+        }
+
+        // Pixels x to x + 7 of row y. x must be a multiple of 8, so a pixel always lands in the same lane
+        // and both shading passes of deferred shading get the same values as forward shading.
+        void evaluate(int x, int y, block& out) const
+        {
+            const simd::float8 px = simd::float8((float)x + 0.5f - x0) + simd::float8::lanes();
+            const float py = (float)y + 0.5f - y0;
+            auto row = [&](int p, int components)
+            {
+                for (int c = p; c < p + components; ++c)
+                    (simd::float8(origin[c] + dy[c] * py) + simd::float8(dx[c]) * px).store(out[c]);
+            };
+
+            row(INV_W, 2);
+            if (attributes & attribute::color)
+                row(COLOR, 3);
+            if (attributes & attribute::normal)
+                row(NORMAL, 3);
+            if (attributes & attribute::tex_coords)
+                row(TEX_COORDS, 2);
+            if (attributes & attribute::view_pos)
+                row(VIEW_POS, 3);
+        }
+    };
+}
+
+inline rst::rasterizer::transformed_vertex rst::rasterizer::cached_vertex(size_t i) const
+{
+    const vertex_block& b = vertex_cache[i / simd::WIDTH];
+    const size_t l = i % simd::WIDTH;
+
+    transformed_vertex v;
+    v.clip_pos = {b.clip[0][l], b.clip[1][l], b.clip[2][l], b.clip[3][l]};
+    v.screen_pos = {b.screen[0][l], b.screen[1][l], b.screen[2][l], b.clip[3][l]};
+    v.view_pos = {b.view[0][l], b.view[1][l], b.view[2][l]};
+    v.normal = {b.normal[0][l], b.normal[1][l], b.normal[2][l]};
+    return v;
+}
+
+template <typename Shader>
+void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList, const Shader& shader)
+{
+    const vertex_uniforms u = get_uniforms();
+
+    draw_triangles(shader, 0, [](size_t) {}, TriangleList.size(), [&](size_t i, clip_stats& stats, auto&& emit)
+    {
+        setup_triangle(u, transform_triangle(u, *TriangleList[i]), stats, emit);
+    });
+}
+
+template <typename Shader>
+void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, const Shader& shader)
+{
+    const auto& blocks = pos_blocks[pos_buffer.pos_id];
+    const auto& ind = ind_buf[ind_buffer.ind_id];
+    const auto& col = col_buf[col_buffer.col_id];
+    const std::vector<vector_block>* normals = normal_id >= 0 ? &nor_blocks[normal_id] : nullptr;
+    const std::vector<Eigen::Vector2f>* texcoords = texcoord_id >= 0 ? &tex_buf[texcoord_id] : nullptr;
+    if (normals && normals->size() < blocks.size())
+        normals = nullptr;
+    if (texcoords && texcoords->size() < pos_buf[pos_buffer.pos_id].size())
+        texcoords = nullptr;
+
+    const vertex_uniforms u = get_uniforms();
+    vertex_cache.resize(blocks.size());
+
+    auto shade_block = [&](size_t i)
+    {
+        transform_block(u, blocks[i], normals ? &(*normals)[i] : nullptr, vertex_cache[i]);
+    };
+
+    auto assemble = [&](size_t t, clip_stats& stats, auto&& emit)
+    {
+        const Eigen::Vector3i& i = ind[t];
+        screen_triangle result;
+        for (int k = 0; k < 3; ++k)
+        {
+            const transformed_vertex vert = cached_vertex(i[k]);
+            result.tri.setVertex(k, vert.screen_pos);
+            result.tri.setNormal(k, vert.normal);
+            result.tri.setColor(k, col[i[k]].x(), col[i[k]].y(), col[i[k]].z());
+            if (texcoords)
+                result.tri.setTexCoord(k, (*texcoords)[i[k]]);
+            result.view_pos[k] = vert.view_pos;
+            result.clip_pos[k] = vert.clip_pos;
+        }
+        setup_triangle(u, std::move(result), stats, emit);
+    };
+
+    draw_triangles(shader, blocks.size(), shade_block, ind.size(), assemble);
+}
+
+template <typename Emit>
+void rst::rasterizer::setup_triangle(const vertex_uniforms& u, screen_triangle&& t, clip_stats& stats, Emit&& emit) const
+{
+    ++stats.input;
+
+    // Outcodes against the frustum sides and the guard band, in the frame where w is positive in front of the camera.
+    const float s = u.front_sign;
+    int all_outside = ~0, any_near = 0, any_guard = 0;
+    for (const Eigen::Vector4f& c : t.clip_pos)
+    {
+        const float x = s * c.x(), y = s * c.y(), w = s * c.w();
+        const int code = (x < -w) | (x > w) << 1 | (y < -w) << 2 | (y > w) << 3 | (w < near_plane) << 4;
+        all_outside &= code;
+        any_near |= w < near_plane;
+        any_guard |= std::abs(x) > guard_band * w || std::abs(y) > guard_band * w;
+    }
+
+    if (all_outside)
+    {
+        ++stats.frustum_rejected;
+        return;
+    }
+
+    if (!any_near && !any_guard)
+    {
+        if (culled(detail::signed_area(t.tri.v[0], t.tri.v[1], t.tri.v[2])))
+        {
+            ++stats.backface_culled;
+            return;
+        }
+        ++stats.output;
+        emit(std::move(t));
+        return;
+    }
+
+    if (any_near)
+        ++stats.near_clipped;
+
+    screen_triangle clipped[MAX_CLIPPED_TRIANGLES];
+    const int count = clip_triangle(u, t, any_guard, stats, clipped);
+    stats.output += count;
+    for (int i = 0; i < count; ++i)
+        emit(std::move(clipped[i]));
+}
+
+template <typename Shader, typename VertexStage, typename Assemble>
+void rst::rasterizer::draw_triangles(const Shader& shader, size_t block_count, VertexStage shade_block, size_t triangle_count, Assemble assemble)
+{
+    stage_timer total;
+    last_draw_stats = {};
+
+    if (!deferred_shading)
+    {
+        if (tile_rendering)
+            draw_tiled(shader, frame_buf, block_count, shade_block, triangle_count, assemble);
+        else
+            draw_serial(shader, frame_buf, block_count, shade_block, triangle_count, assemble);
+    }
+    else
+    {
+        // First pass only resolves visibility, the second one shades every covered pixel once.
+        stage_timer clear_timer;
+        std::fill(vis_buf.begin(), vis_buf.end(), visibility_sample{visibility_sample::NONE});
+        clear_timer.lap(last_draw_stats, draw_stage::output);
+
+        detail::visibility_target visibility{vis_buf.data()};
+        if (tile_rendering)
+            draw_tiled(shader, visibility, block_count, shade_block, triangle_count, assemble);
+        else
+            draw_serial(shader, visibility, block_count, shade_block, triangle_count, assemble);
+
+        resolve_visibility(shader);
+    }
+
+    last_draw_stats.triangles_in = last_clip_stats.input;
+    last_draw_stats.triangles_culled = last_clip_stats.frustum_rejected + last_clip_stats.backface_culled;
+    last_draw_stats.triangles_clipped = last_clip_stats.near_clipped + last_clip_stats.guard_band_clipped;
+    last_draw_stats.triangles_rasterized = last_clip_stats.output;
+    last_draw_stats.total_ms = total.lap_ms();
+}
+
+template <typename Shader, typename Output, typename VertexStage, typename Assemble>
+void rst::rasterizer::draw_serial(const Shader& shader, Output& output, size_t block_count, VertexStage shade_block, size_t triangle_count, Assemble assemble)
+{
+    // The second pass of deferred shading looks triangles up by id.
+    constexpr bool keep_triangles = std::is_same_v<Output, detail::visibility_target>;
+
+    draw_stats stats;
+    stage_timer timer;
+
+    for (size_t i = 0; i < block_count; ++i)
+        shade_block(i);
+    timer.lap(stats, draw_stage::vertex);
+
+    detail::frame_pixels<Output> target{output, depth_buf.data(), hiz_buf.data(), width, height, hiz_blocks_x};
+    const rect screen{0, 0, width, height};
+
+    assembled.resize(1);
+    assembled[0].clear();
+    assembled_offset.assign(2, 0);
+
+    clip_stats triangles;
+    uint32_t id = 0;
+    auto emit = [&](screen_triangle&& newtri)
+    {
+        timer.lap(stats, draw_stage::setup);
+        // Also pass view space vertice position
+        rasterize_triangle(newtri.tri, newtri.view_pos, id++, screen, target, shader, stats);
+        timer.skip();
+
+        if (keep_triangles)
+            assembled[0].push_back(std::move(newtri));
+    };
+
+    for (size_t i = 0; i < triangle_count; ++i)
+        assemble(i, triangles, emit);
+    timer.lap(stats, draw_stage::setup);
+
+    assembled_offset[1] = id;
+    last_clip_stats = triangles;
+    last_draw_stats += stats;
+}
+
+// Three phases:
+//   1. Every worker runs the vertex stage for a contiguous chunk of the vertex cache, if there is one.
+//   2. Every worker runs primitive assembly on a contiguous chunk of the triangles into its own list
+//      and bins the results into screen tiles.
+//   3. Workers pull tiles from a shared counter and rasterize all triangles binned to that tile
+//      into their own tile memory, then write the tile back to output.
+// Triangles of a tile are visited in submission order, so the output matches the serial path.
+template <typename Shader, typename Output, typename VertexStage, typename Assemble>
+void rst::rasterizer::draw_tiled(const Shader& shader, Output& output, size_t block_count, VertexStage shade_block, size_t triangle_count, Assemble assemble)
+{
+    last_clip_stats = {};
+    if (triangle_count == 0)
+        return;
+
+    const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    const int tile_count = tiles_x * tiles_y;
+    const int workers = worker_count();
+    const rect screen{0, 0, width, height};
+
+    assembled.resize(workers);
+    assembled_offset.assign(workers + 1, 0);
+    std::vector<clip_stats> stats(workers);
+    std::vector<draw_stats> timings(workers);
+    // bins[worker][tile] holds indices into assembled[worker] of the triangles which touch the tile.
+    std::vector<std::vector<std::vector<uint32_t>>> bins(workers, std::vector<std::vector<uint32_t>>(tile_count));
+    std::atomic<int> next_tile = 0;
+    std::barrier sync(workers);
+
+    auto work = [&](int worker)
+    {
+        draw_stats& timing = timings[worker];
+        stage_timer timer;
+
+        if (block_count > 0)
+        {
+            for (size_t i = block_count * worker / workers; i < block_count * (worker + 1) / workers; ++i)
+                shade_block(i);
+            timer.lap(timing, draw_stage::vertex);
+            sync.arrive_and_wait();
+            timer.skip();
+        }
+
+        const size_t begin = triangle_count * worker / workers;
+        const size_t end = triangle_count * (worker + 1) / workers;
+        auto& worker_bins = bins[worker];
+        auto& triangles = assembled[worker];
+        triangles.clear();
+
+        auto emit = [&](screen_triangle&& t)
+        {
+            const uint32_t index = (uint32_t)triangles.size();
+            triangles.push_back(std::move(t));
+
+            rect box = bounding_rect(triangles.back().tri, screen);
+            if (box.x0 >= box.x1 || box.y0 >= box.y1)
+                return;
+            for (int ty = box.y0 / TILE_SIZE; ty <= (box.y1 - 1) / TILE_SIZE; ++ty)
+            {
+                for (int tx = box.x0 / TILE_SIZE; tx <= (box.x1 - 1) / TILE_SIZE; ++tx)
+                {
+                    worker_bins[ty * tiles_x + tx].push_back(index);
+                }
+            }
+        };
+
+        for (size_t i = begin; i < end; ++i)
+            assemble(i, stats[worker], emit);
+        timer.lap(timing, draw_stage::setup);
+
+        sync.arrive_and_wait();
+
+        // Ids of a worker's triangles start after those of all previous workers.
+        if (worker == 0)
+        {
+            for (int w = 0; w < workers; ++w)
+                assembled_offset[w + 1] = assembled_offset[w] + (uint32_t)assembled[w].size();
+        }
+        sync.arrive_and_wait();
+        timer.skip();
+
+        detail::tile_pixels<typename Output::sample_type> tile;
+        for (int tile_id = next_tile++; tile_id < tile_count; tile_id = next_tile++)
+        {
+            bool empty = std::all_of(bins.begin(), bins.end(), [tile_id](const auto& b) { return b[tile_id].empty(); });
+            if (empty)
+                continue;
+
+            tile.x0 = (tile_id % tiles_x) * TILE_SIZE;
+            tile.y0 = (tile_id / tiles_x) * TILE_SIZE;
+            const rect bounds{tile.x0, tile.y0, std::min(tile.x0 + TILE_SIZE, width), std::min(tile.y0 + TILE_SIZE, height)};
+
+            std::fill(tile.written.begin(), tile.written.end(), 0);
+            std::fill(tile.depth_buf.begin(), tile.depth_buf.end(), -std::numeric_limits<float>::infinity());
+            for (int y = bounds.y0; y < bounds.y1; ++y)
+            {
+                for (int x = bounds.x0; x < bounds.x1; ++x)
+                {
+                    tile.depth(x, y) = depth_buf[get_index(x, y)];
+                }
+            }
+            for (int by = bounds.y0 / HIZ_BLOCK; by < (bounds.y1 + HIZ_BLOCK - 1) / HIZ_BLOCK; ++by)
+            {
+                for (int bx = bounds.x0 / HIZ_BLOCK; bx < (bounds.x1 + HIZ_BLOCK - 1) / HIZ_BLOCK; ++bx)
+                {
+                    tile.hiz(bx, by) = hiz_buf[by * hiz_blocks_x + bx];
+                }
+            }
+            timer.lap(timing, draw_stage::output);
+
+            for (int w = 0; w < workers; ++w)
+            {
+                for (uint32_t i : bins[w][tile_id])
+                {
+                    const screen_triangle& t = assembled[w][i];
+                    rasterize_triangle(t.tri, t.view_pos, assembled_offset[w] + i, bounds, tile, shader, timing);
+                }
+            }
+            timer.skip();
+
+            for (int y = bounds.y0; y < bounds.y1; ++y)
+            {
+                for (int x = bounds.x0; x < bounds.x1; ++x)
+                {
+                    int ind = get_index(x, y);
+                    depth_buf[ind] = tile.depth(x, y);
+                    if (tile.written[tile.index(x, y)])
+                        output.store(ind, tile.color[tile.index(x, y)]);
+                }
+            }
+            for (int by = bounds.y0 / HIZ_BLOCK; by < (bounds.y1 + HIZ_BLOCK - 1) / HIZ_BLOCK; ++by)
+            {
+                for (int bx = bounds.x0 / HIZ_BLOCK; bx < (bounds.x1 + HIZ_BLOCK - 1) / HIZ_BLOCK; ++bx)
+                {
+                    hiz_buf[by * hiz_blocks_x + bx] = tile.hiz(bx, by);
+                }
+            }
+            timer.lap(timing, draw_stage::output);
+        }
+    };
+
+    pool.run(workers, work);
+
+    for (const clip_stats& s : stats)
+        last_clip_stats += s;
+    for (const draw_stats& s : timings)
+        last_draw_stats += s;
+}
+
+// Second pass of deferred shading. Rows are handed out to the workers, every pixel covered
+// by the last draw is shaded once from its triangle id and barycentrics.
+template <typename Shader>
+void rst::rasterizer::resolve_visibility(const Shader& shader)
+{
+    std::atomic<int> next_row = 0;
+    std::vector<draw_stats> timings(worker_count());
+
+    auto work = [&](int worker)
+    {
+        draw_stats& timing = timings[worker];
+        stage_timer timer;
+
+        // Neighboring pixels mostly belong to the same triangle, so its setup and the last evaluated
+        // 8 pixel block are kept until the triangle changes.
+        uint32_t setup_id = visibility_sample::NONE;
+        int block_x = -1, block_y = -1;
+        detail::attribute_planes planes;
+        detail::attribute_planes::block values;
+        float tex_lod = 0;
+
+        for (int row = next_row++; row < height; row = next_row++)
+        {
+            const int y = height - 1 - row;
+            for (int x = 0; x < width; ++x)
+            {
+                const int ind = row * width + x;
+                const visibility_sample& sample = vis_buf[ind];
+                if (sample.id == visibility_sample::NONE)
+                    continue;
+
+                if (sample.id != setup_id)
+                {
+                    const screen_triangle& st = assembled_triangle(sample.id);
+                    planes.setup(st.tri, st.view_pos, detail::shader_attributes<Shader>());
+                    tex_lod = triangle_lod(st.tri);
+                    setup_id = sample.id;
+                    block_x = -1;
+                }
+
+                // Same blocks as the first pass, so the result matches forward shading.
+                const int bx = x & ~(simd::WIDTH - 1);
+                if (bx != block_x || y != block_y)
+                {
+                    planes.evaluate(bx, y, values);
+                    block_x = bx;
+                    block_y = y;
+                }
+
+                frame_buf.store(ind, shade_fragment(values, x - bx, tex_lod, shader));
+                if constexpr (stats_enabled)
+                    ++timing.fragment_shader_invocations;
+            }
+        }
+        timer.lap(timing, draw_stage::fragment);
+    };
+
+    pool.run((int)timings.size(), work);
+
+    for (const draw_stats& s : timings)
+        last_draw_stats += s;
+}
+
+template <typename Shader>
+Eigen::Vector3f rst::rasterizer::shade_fragment(const float (*values)[simd::WIDTH], int lane, float tex_lod, const Shader& shader)
+{
+    using planes = detail::attribute_planes;
+    constexpr unsigned used = detail::shader_attributes<Shader>();
+
+    // Perspective correction: every plane holds attribute / w.
+    const float w = 1.0f / values[planes::INV_W][lane];
+    auto vec3 = [&](int p) { return Eigen::Vector3f(values[p][lane] * w, values[p + 1][lane] * w, values[p + 2][lane] * w); };
+
+    fragment_shader_payload payload;
+    payload.texture = texture ? &*texture : nullptr;
+    payload.tex_lod = tex_lod;
+    if constexpr ((used & attribute::color) != 0)
+        payload.color = vec3(planes::COLOR);
+    else
+        payload.color.setZero();
+    if constexpr ((used & attribute::normal) != 0)
+        payload.normal = vec3(planes::NORMAL).normalized();
+    else
+        payload.normal.setZero();
+    if constexpr ((used & attribute::tex_coords) != 0)
+        payload.tex_coords = Eigen::Vector2f(values[planes::TEX_COORDS][lane] * w, values[planes::TEX_COORDS + 1][lane] * w);
+    else
+        payload.tex_coords.setZero();
+    if constexpr ((used & attribute::view_pos) != 0)
+        payload.view_pos = vec3(planes::VIEW_POS);
+    else
+        payload.view_pos.setZero();
+    return shader(payload, uniforms);
+}
+
+//Screen space rasterization, limited to the pixels inside bounds.
+template <typename Shader, typename View>
+void rst::rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos, uint32_t id, const rect& bounds, View& target, const Shader& shader, draw_stats& stats)
+{
+    if (fixed_point)
+        scan_triangle<fixed_edge_equations>(t, view_pos, id, bounds, target, shader, stats);
+    else
+        scan_triangle<edge_equations>(t, view_pos, id, bounds, target, shader, stats);
+}
+
+template <typename Edges, typename Shader, typename View>
+void rst::rasterizer::scan_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos, uint32_t id, const rect& bounds, View& target, const Shader& shader, draw_stats& stats)
+{
+    constexpr bool deferred = std::is_same_v<typename View::sample_type, visibility_sample>;
+
+    //    * v[i].w() is the vertex view space depth value z.
+    //    * Z is interpolated view space depth for the current pixel
+    //    * zp is depth between zNear and zFar, used for z-buffer
+    const Eigen::Vector4f* v = t.v;
+    stage_timer timer;
+
+    Edges edges;
+    if (!edges.setup(v))
+    {
+        timer.lap(stats, draw_stage::raster);
+        return;
+    }
+
+    const rect box = bounding_rect(t, bounds);
+    if (box.x0 >= box.x1 || box.y0 >= box.y1)
+    {
+        timer.lap(stats, draw_stage::raster);
+        return;
+    }
+    edges.limit(box.x0, box.y0, box.x1, box.y1);
+
+    // Every pixel depth is a weighted average of the vertex depths, so the nearest vertex bounds
+    // the whole triangle. That only holds when the perspective weights are positive, i.e. all w have the same sign.
+    const bool hiz_test = (v[0].w() > 0 && v[1].w() > 0 && v[2].w() > 0) || (v[0].w() < 0 && v[1].w() < 0 && v[2].w() < 0);
+    const float nearest = std::min({v[0].z(), v[1].z(), v[2].z()});
+
+    const float tex_lod = deferred ? 0.0f : triangle_lod(t);
+
+    // The visibility pass only needs depth, its attributes are set up again when the pixels are shaded.
+    detail::attribute_planes planes;
+    if (!planes.setup(t, view_pos, deferred ? 0u : detail::shader_attributes<Shader>()))
+    {
+        timer.lap(stats, draw_stage::raster);
+        return;
+    }
+    detail::attribute_planes::block values;
+    float depth_zp[simd::WIDTH];
+
+    for (int by = box.y0 / HIZ_BLOCK; by <= (box.y1 - 1) / HIZ_BLOCK; ++by)
+    {
+        for (int bx = box.x0 / HIZ_BLOCK; bx <= (box.x1 - 1) / HIZ_BLOCK; ++bx)
+        {
+            // The whole block is already nearer than the triangle.
+            if (hiz_test && nearest >= target.hiz(bx, by))
+                continue;
+
+            const int x = bx * HIZ_BLOCK;
+            const int x_mask = span_mask(x, box.x0, box.x1);
+            bool written = false;
+
+            for (int y = std::max(by * HIZ_BLOCK, box.y0); y < std::min((by + 1) * HIZ_BLOCK, box.y1); ++y)
+            {
+                auto b = edges.evaluate(x, edges.row(y));
+                int mask = b.mask & x_mask;
+                if constexpr (stats_enabled)
+                {
+                    stats.pixels_tested += std::popcount((unsigned)x_mask);
+                    stats.pixels_covered += std::popcount((unsigned)mask);
+                }
+                if (!mask)
+                    continue;
+
+                planes.evaluate(x, y, values);
+                const simd::float8 zp = simd::float8::load(values[detail::attribute_planes::Z_W]) /
+                                        simd::float8::load(values[detail::attribute_planes::INV_W]);
+                zp.store(depth_zp);
+
+                // Depth tests and shading of the covered lanes count as fragment time in forward shading.
+                if constexpr (!deferred)
+                    timer.lap(stats, draw_stage::raster);
+
+                for (; mask; mask &= mask - 1)
+                {
+                    const int lane = std::countr_zero((unsigned)mask);
+                    const int px = x + lane;
+
+                    float& depth = target.depth(px, y);
+                    if (depth_zp[lane] >= depth)
+                    {
+                        if constexpr (stats_enabled)
+                            ++stats.pixels_depth_rejected;
+                        continue;
+                    }
+                    depth = depth_zp[lane];
+                    written = true;
+
+                    if constexpr (deferred)
+                        target.write(px, y, visibility_sample{id});
+                    else
+                    {
+                        target.write(px, y, shade_fragment(values, lane, tex_lod, shader));
+                        if constexpr (stats_enabled)
+                            ++stats.fragment_shader_invocations;
+                    }
+                }
+
+                if constexpr (!deferred)
+                    timer.lap(stats, draw_stage::fragment);
+            }
+
+            if (written)
+                target.update_hiz(bx, by);
+        }
+    }
+    timer.lap(stats, draw_stage::raster);
+}
@@ -5,6 +5,7 @@
 #ifndef RASTERIZER_SHADER_H
 #define RASTERIZER_SHADER_H
 #include <eigen3/Eigen/Eigen>
+#include <span>
 #include "Texture.hpp"
 
 
@@ -24,6 +25,68 @@ struct fragment_shader_payload
     Eigen::Vector3f normal;
     Eigen::Vector2f tex_coords;
     Texture* texture;
+    // Mip level of texture for this triangle, see Texture::getColorTrilinear.
+    float tex_lod = 0;
+};
+
+struct light
+{
+    Eigen::Vector3f position;
+    Eigen::Vector3f intensity;
+};
+
+// Constants shared by every fragment of a draw call, set once with rasterizer::set_uniforms.
+struct shader_uniforms
+{
+    static constexpr int MAX_LIGHTS = 4;
+
+    light lights[MAX_LIGHTS];
+    int light_count = 0;
+
+    Eigen::Vector3f amb_light_intensity{10, 10, 10};
+    Eigen::Vector3f eye_pos{0, 0, 10};
+
+    // Material
+    Eigen::Vector3f ka{0.005, 0.005, 0.005};
+    Eigen::Vector3f ks{0.7937, 0.7937, 0.7937};
+    float p = 150;
+
+    // Bump and displacement mapping
+    float kh = 0.2, kn = 0.1;
+
+    void add_light(const light& l)
+    {
+        if (light_count < MAX_LIGHTS)
+            lights[light_count++] = l;
+    }
+
+    std::span<const light> active_lights() const { return {lights, (size_t)light_count}; }
+};
+
+// Interpolated members of fragment_shader_payload. A shader type can list the ones it reads in a
+// static constexpr unsigned attributes member, the rasterizer then skips interpolating the others.
+namespace attribute
+{
+    enum : unsigned
+    {
+        color = 1,
+        normal = 2,
+        tex_coords = 4,
+        view_pos = 8,
+        all = color | normal | tex_coords | view_pos
+    };
+}
+
+// Gives a shader function its own type, so the templated rasterizer::draw can inline it.
+template <auto Function, unsigned Attributes = attribute::all>
+struct static_shader
+{
+    static constexpr unsigned attributes = Attributes;
+
+    Eigen::Vector3f operator()(const fragment_shader_payload& payload, const shader_uniforms& uniforms) const
+    {
+        return Function(payload, uniforms);
+    }
 };
 
 struct vertex_shader_payload
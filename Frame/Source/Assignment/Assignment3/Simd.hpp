@@ -0,0 +1,284 @@
+#pragma once
+
+// Thin 8-wide float wrapper used by the rasterizer inner loops.
+// AVX2 builds use one 256 bit register, SSE builds use two 128 bit registers,
+// anything else falls back to plain scalar loops.
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define SIMD_SSE 1
+#endif
+
+#include <algorithm>
+#include <cstdint>
+
+namespace simd
+{
+    constexpr int WIDTH = 8;
+
+#if defined(SIMD_AVX2)
+
+    struct float8
+    {
+        __m256 v;
+
+        float8() = default;
+        float8(__m256 x) : v(x) {}
+        explicit float8(float x) : v(_mm256_set1_ps(x)) {}
+
+        static float8 load(const float* p) { return _mm256_loadu_ps(p); }
+        void store(float* p) const { _mm256_storeu_ps(p, v); }
+        // 0, 1, ..., 7
+        static float8 lanes() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+    };
+
+    inline float8 operator+(float8 a, float8 b) { return _mm256_add_ps(a.v, b.v); }
+    inline float8 operator-(float8 a, float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    inline float8 operator*(float8 a, float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    inline float8 operator/(float8 a, float8 b) { return _mm256_div_ps(a.v, b.v); }
+    inline float8 min(float8 a, float8 b) { return _mm256_min_ps(a.v, b.v); }
+    inline float8 max(float8 a, float8 b) { return _mm256_max_ps(a.v, b.v); }
+
+    // Comparisons return one bit per lane, bit i is lane i.
+    inline int greater(float8 a, float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+    inline int less(float8 a, float8 b) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+
+#elif defined(SIMD_SSE)
+
+    struct float8
+    {
+        __m128 lo, hi;
+
+        float8() = default;
+        float8(__m128 l, __m128 h) : lo(l), hi(h) {}
+        explicit float8(float x) : lo(_mm_set1_ps(x)), hi(_mm_set1_ps(x)) {}
+
+        static float8 load(const float* p) { return {_mm_loadu_ps(p), _mm_loadu_ps(p + 4)}; }
+        void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+        static float8 lanes() { return {_mm_setr_ps(0, 1, 2, 3), _mm_setr_ps(4, 5, 6, 7)}; }
+    };
+
+    inline float8 operator+(float8 a, float8 b) { return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)}; }
+    inline float8 operator-(float8 a, float8 b) { return {_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)}; }
+    inline float8 operator*(float8 a, float8 b) { return {_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)}; }
+    inline float8 operator/(float8 a, float8 b) { return {_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)}; }
+    inline float8 min(float8 a, float8 b) { return {_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)}; }
+    inline float8 max(float8 a, float8 b) { return {_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)}; }
+
+    inline int greater(float8 a, float8 b)
+    {
+        return _mm_movemask_ps(_mm_cmpgt_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmpgt_ps(a.hi, b.hi)) << 4);
+    }
+    inline int less(float8 a, float8 b)
+    {
+        return _mm_movemask_ps(_mm_cmplt_ps(a.lo, b.lo)) | (_mm_movemask_ps(_mm_cmplt_ps(a.hi, b.hi)) << 4);
+    }
+
+#else
+
+    struct float8
+    {
+        float v[WIDTH];
+
+        float8() = default;
+        explicit float8(float x) { std::fill(v, v + WIDTH, x); }
+
+        static float8 load(const float* p) { float8 r; std::copy(p, p + WIDTH, r.v); return r; }
+        void store(float* p) const { std::copy(v, v + WIDTH, p); }
+        static float8 lanes() { float8 r; for (int i = 0; i < WIDTH; ++i) r.v[i] = (float)i; return r; }
+    };
+
+    template <typename Op>
+    inline float8 apply(float8 a, float8 b, Op op)
+    {
+        float8 r;
+        for (int i = 0; i < WIDTH; ++i)
+            r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+
+    inline float8 operator+(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+    inline float8 operator-(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+    inline float8 operator*(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+    inline float8 operator/(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x / y; }); }
+    inline float8 min(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+    inline float8 max(float8 a, float8 b) { return apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+
+    inline int greater(float8 a, float8 b)
+    {
+        int mask = 0;
+        for (int i = 0; i < WIDTH; ++i)
+            mask |= (a.v[i] > b.v[i]) << i;
+        return mask;
+    }
+    inline int less(float8 a, float8 b)
+    {
+        int mask = 0;
+        for (int i = 0; i < WIDTH; ++i)
+            mask |= (a.v[i] < b.v[i]) << i;
+        return mask;
+    }
+
+#endif
+
+    // 8-wide int32 with wrap around addition, used by the fixed point coverage test.
+#if defined(SIMD_AVX2)
+
+    struct int8
+    {
+        __m256i v;
+
+        int8() = default;
+        int8(__m256i x) : v(x) {}
+        explicit int8(int32_t x) : v(_mm256_set1_epi32(x)) {}
+
+        static int8 load(const int32_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    };
+
+    inline int8 operator+(int8 a, int8 b) { return _mm256_add_epi32(a.v, b.v); }
+    inline int greater(int8 a, int8 b) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a.v, b.v))); }
+
+#elif defined(SIMD_SSE)
+
+    struct int8
+    {
+        __m128i lo, hi;
+
+        int8() = default;
+        int8(__m128i l, __m128i h) : lo(l), hi(h) {}
+        explicit int8(int32_t x) : lo(_mm_set1_epi32(x)), hi(_mm_set1_epi32(x)) {}
+
+        static int8 load(const int32_t* p) { return {_mm_loadu_si128((const __m128i*)p), _mm_loadu_si128((const __m128i*)(p + 4))}; }
+    };
+
+    inline int8 operator+(int8 a, int8 b) { return {_mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi)}; }
+    inline int greater(int8 a, int8 b)
+    {
+        return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a.lo, b.lo))) |
+            (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a.hi, b.hi))) << 4);
+    }
+
+#else
+
+    struct int8
+    {
+        int32_t v[WIDTH];
+
+        int8() = default;
+        explicit int8(int32_t x) { std::fill(v, v + WIDTH, x); }
+
+        static int8 load(const int32_t* p) { int8 r; std::copy(p, p + WIDTH, r.v); return r; }
+    };
+
+    inline int8 operator+(int8 a, int8 b)
+    {
+        int8 r;
+        for (int i = 0; i < WIDTH; ++i)
+            r.v[i] = (int32_t)((uint32_t)a.v[i] + (uint32_t)b.v[i]);
+        return r;
+    }
+    inline int greater(int8 a, int8 b)
+    {
+        int mask = 0;
+        for (int i = 0; i < WIDTH; ++i)
+            mask |= (a.v[i] > b.v[i]) << i;
+        return mask;
+    }
+
+#endif
+
+    // 4-wide float, used for RGBA texels and small batches such as texture samples.
+#if defined(SIMD_AVX2) || defined(SIMD_SSE)
+
+    struct float4
+    {
+        __m128 v;
+
+        float4() = default;
+        float4(__m128 x) : v(x) {}
+        explicit float4(float x) : v(_mm_set1_ps(x)) {}
+
+        static float4 load(const float* p) { return _mm_loadu_ps(p); }
+        void store(float* p) const { _mm_storeu_ps(p, v); }
+        // Truncates towards zero.
+        void store_int(int* p) const { _mm_storeu_si128((__m128i*)p, _mm_cvttps_epi32(v)); }
+        // Byte i of x goes to lane i.
+        static float4 from_bytes(uint32_t x)
+        {
+            __m128i zero = _mm_setzero_si128();
+            __m128i b = _mm_cvtsi32_si128((int)x);
+            b = _mm_unpacklo_epi16(_mm_unpacklo_epi8(b, zero), zero);
+            return _mm_cvtepi32_ps(b);
+        }
+        // Byte `byte` of p[i] goes to lane i, e.g. one color channel of 4 texels.
+        static float4 from_byte_lanes(const uint32_t* p, int byte)
+        {
+            __m128i b = _mm_srl_epi32(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128(8 * byte));
+            return _mm_cvtepi32_ps(_mm_and_si128(b, _mm_set1_epi32(0xff)));
+        }
+    };
+
+    inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+    inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+    inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+    inline float4 min(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+    inline float4 max(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+    // Rounds towards zero.
+    inline float4 truncate(float4 a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v)); }
+
+#else
+
+    struct float4
+    {
+        float v[4];
+
+        float4() = default;
+        explicit float4(float x) { std::fill(v, v + 4, x); }
+
+        static float4 load(const float* p) { float4 r; std::copy(p, p + 4, r.v); return r; }
+        void store(float* p) const { std::copy(v, v + 4, p); }
+        void store_int(int* p) const { for (int i = 0; i < 4; ++i) p[i] = (int)v[i]; }
+        static float4 from_bytes(uint32_t x)
+        {
+            float4 r;
+            for (int i = 0; i < 4; ++i)
+                r.v[i] = (float)((x >> (8 * i)) & 0xff);
+            return r;
+        }
+        static float4 from_byte_lanes(const uint32_t* p, int byte)
+        {
+            float4 r;
+            for (int i = 0; i < 4; ++i)
+                r.v[i] = (float)((p[i] >> (8 * byte)) & 0xff);
+            return r;
+        }
+    };
+
+    template <typename Op>
+    inline float4 apply(float4 a, float4 b, Op op)
+    {
+        float4 r;
+        for (int i = 0; i < 4; ++i)
+            r.v[i] = op(a.v[i], b.v[i]);
+        return r;
+    }
+
+    inline float4 operator+(float4 a, float4 b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+    inline float4 operator-(float4 a, float4 b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+    inline float4 operator*(float4 a, float4 b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+    inline float4 min(float4 a, float4 b) { return apply(a, b, [](float x, float y) { return x < y ? x : y; }); }
+    inline float4 max(float4 a, float4 b) { return apply(a, b, [](float x, float y) { return x > y ? x : y; }); }
+    inline float4 truncate(float4 a) { return apply(a, a, [](float x, float) { return (float)(int)x; }); }
+
+#endif
+
+    inline float reduce_max(float8 a)
+    {
+        float v[WIDTH];
+        a.store(v);
+        return *std::max_element(v, v + WIDTH);
+    }
+}
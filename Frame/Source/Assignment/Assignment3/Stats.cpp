@@ -0,0 +1,24 @@
+#include "Stats.hpp"
+
+#include <sstream>
+
+std::string rst::draw_stats::to_json() const
+{
+    static constexpr const char* STAGE_NAMES[(int)draw_stage::count] = {"vertex", "setup", "raster", "fragment", "output"};
+
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"enabled\": " << (stats_enabled ? "true" : "false") << ",\n";
+    out << "  \"total_ms\": " << total_ms << ",\n";
+    out << "  \"stage_ms\": {";
+    for (int i = 0; i < (int)draw_stage::count; ++i)
+        out << (i ? ", " : "") << "\"" << STAGE_NAMES[i] << "\": " << stage_ms[i];
+    out << "},\n";
+    out << "  \"triangles\": {\"in\": " << triangles_in << ", \"culled\": " << triangles_culled
+        << ", \"clipped\": " << triangles_clipped << ", \"rasterized\": " << triangles_rasterized << "},\n";
+    out << "  \"pixels\": {\"tested\": " << pixels_tested << ", \"covered\": " << pixels_covered
+        << ", \"depth_rejected\": " << pixels_depth_rejected << "},\n";
+    out << "  \"fragment_shader_invocations\": " << fragment_shader_invocations << "\n";
+    out << "}";
+    return out.str();
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// Per draw call timing and counters of rst::rasterizer, see rasterizer::get_draw_stats.
+//
+// Stage times and pixel counters cost a clock read or an add in the inner loops, so they are only
+// collected when the rasterizer is built with RST_ENABLE_STATS=1. Otherwise every timer and counter
+// update compiles to nothing and only the triangle counts, which come from the clip stats, are filled in.
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#ifndef RST_ENABLE_STATS
+    #define RST_ENABLE_STATS 0
+#endif
+
+namespace rst
+{
+    inline constexpr bool stats_enabled = RST_ENABLE_STATS != 0;
+
+    enum class draw_stage
+    {
+        // Vertex transform into the vertex cache.
+        vertex,
+        // Primitive assembly, culling, clipping and tile binning.
+        setup,
+        // Coverage, Hi-Z and depth tests.
+        raster,
+        // Attribute interpolation and the fragment shader, the second pass in deferred shading mode.
+        fragment,
+        // Copying tiles to and from the frame buffer, converting to its color format and clearing the visibility buffer.
+        output,
+        count
+    };
+
+    struct draw_stats
+    {
+        // Milliseconds per stage, summed over all worker threads. total_ms is the wall time of the draw call.
+        double stage_ms[(int)draw_stage::count] = {};
+        double total_ms = 0;
+
+        uint64_t triangles_in = 0;
+        // Frustum rejected or backface culled.
+        uint64_t triangles_culled = 0;
+        uint64_t triangles_clipped = 0;
+        // Triangles sent to the rasterizer after clipping.
+        uint64_t triangles_rasterized = 0;
+
+        // Pixels inside a triangle's bounding box whose coverage was tested, blocks skipped by Hi-Z are not counted.
+        uint64_t pixels_tested = 0;
+        uint64_t pixels_covered = 0;
+        uint64_t pixels_depth_rejected = 0;
+        uint64_t fragment_shader_invocations = 0;
+
+        double& time(draw_stage s) { return stage_ms[(int)s]; }
+        double time(draw_stage s) const { return stage_ms[(int)s]; }
+
+        draw_stats& operator+=(const draw_stats& o)
+        {
+            for (int i = 0; i < (int)draw_stage::count; ++i)
+                stage_ms[i] += o.stage_ms[i];
+            total_ms += o.total_ms;
+            triangles_in += o.triangles_in;
+            triangles_culled += o.triangles_culled;
+            triangles_clipped += o.triangles_clipped;
+            triangles_rasterized += o.triangles_rasterized;
+            pixels_tested += o.pixels_tested;
+            pixels_covered += o.pixels_covered;
+            pixels_depth_rejected += o.pixels_depth_rejected;
+            fragment_shader_invocations += o.fragment_shader_invocations;
+            return *this;
+        }
+
+        std::string to_json() const;
+    };
+
+    // Splits the running time of a thread into stages: every lap adds the time since the previous one to a stage.
+    class stage_timer
+    {
+    public:
+        // Milliseconds since the previous lap or since construction, always 0 when stats are compiled out.
+        double lap_ms()
+        {
+#if RST_ENABLE_STATS
+            auto now = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration<double, std::milli>(now - last).count();
+            last = now;
+            return ms;
+#else
+            return 0;
+#endif
+        }
+
+        void lap(draw_stats& stats, draw_stage s)
+        {
+            if constexpr (stats_enabled)
+                stats.time(s) += lap_ms();
+        }
+
+        // Drops the time since the previous lap, e.g. time spent waiting for other workers.
+        void skip() { lap_ms(); }
+
+    private:
+#if RST_ENABLE_STATS
+        std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+#endif
+    };
+}
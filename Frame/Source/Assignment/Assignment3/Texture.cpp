@@ -2,3 +2,123 @@
 // Created by LEI XU on 4/27/19.
 //
 
+#include "Texture.hpp"
+#include <opencv2/opencv.hpp>
+
+Texture::Texture(const std::string& name)
+{
+    cv::Mat image_data = cv::imread(name);
+    if (image_data.empty())
+    {
+        // Keep a single black texel, so sampling a missing texture is still safe.
+        image_data = cv::Mat(1, 1, CV_8UC3, cv::Scalar(0, 0, 0));
+    }
+    cv::cvtColor(image_data, image_data, cv::COLOR_RGB2BGR);
+    width = image_data.cols;
+    height = image_data.rows;
+
+    // Level 0 in float, each further level is the 2x2 box filtered previous one.
+    std::vector<Eigen::Vector3f> src(width * height);
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            auto color = image_data.at<cv::Vec3b>(y, x);
+            src[y * width + x] = Eigen::Vector3f(color[0], color[1], color[2]);
+        }
+    }
+
+    int w = width, h = height;
+    while (true)
+    {
+        level l;
+        l.width = w;
+        l.height = h;
+        l.tiles_x = (w + 3) / 4;
+        l.texels.assign(l.tiles_x * ((h + 3) / 4) * 16, 0);
+        for (int y = 0; y < h; ++y)
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                const Eigen::Vector3f& c = src[y * w + x];
+                uint32_t r = (uint32_t)std::lround(c.x()), g = (uint32_t)std::lround(c.y()), b = (uint32_t)std::lround(c.z());
+                l.texels[((y >> 2) * l.tiles_x + (x >> 2)) * 16 + (y & 3) * 4 + (x & 3)] = r | (g << 8) | (b << 16) | (255u << 24);
+            }
+        }
+        levels.push_back(std::move(l));
+
+        if (w == 1 && h == 1)
+            break;
+
+        int nw = std::max(1, w / 2), nh = std::max(1, h / 2);
+        std::vector<Eigen::Vector3f> dst(nw * nh);
+        for (int y = 0; y < nh; ++y)
+        {
+            for (int x = 0; x < nw; ++x)
+            {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+                dst[y * nw + x] = (src[y0 * w + x0] + src[y0 * w + x1] + src[y1 * w + x0] + src[y1 * w + x1]) * 0.25f;
+            }
+        }
+        src = std::move(dst);
+        w = nw;
+        h = nh;
+    }
+}
+
+void Texture::sample4(const float u[4], const float v[4], float lod, Eigen::Vector3f out[4]) const
+{
+    lod = std::clamp(lod, 0.0f, (float)(levels.size() - 1));
+    const int l0 = (int)lod;
+    const float t = lod - (float)l0;
+    const int level_count = t == 0.0f ? 1 : 2;
+
+    // One register per color channel, lane s is sample s.
+    simd::float4 acc[3];
+    for (int i = 0; i < level_count; ++i)
+    {
+        const level& l = levels[l0 + i];
+
+        // Texel space coordinates of all four samples at once.
+        simd::float4 x = simd::float4::load(u) * simd::float4((float)l.width) - simd::float4(0.5f);
+        simd::float4 y = (simd::float4(1.0f) - simd::float4::load(v)) * simd::float4((float)l.height) - simd::float4(0.5f);
+        x = simd::min(simd::max(x, simd::float4(0.0f)), simd::float4((float)(l.width - 1)));
+        y = simd::min(simd::max(y, simd::float4(0.0f)), simd::float4((float)(l.height - 1)));
+
+        const simd::float4 x0 = simd::truncate(x), y0 = simd::truncate(y);
+        const simd::float4 fx = x - x0, fy = y - y0;
+        int xs[4], ys[4];
+        x0.store_int(xs);
+        y0.store_int(ys);
+
+        // The 2x2 footprints, texels[corner][sample] with the corners in the order of blend.
+        uint32_t texels[4][4];
+        for (int s = 0; s < 4; ++s)
+        {
+            const int x1 = std::min(xs[s] + 1, l.width - 1), y1 = std::min(ys[s] + 1, l.height - 1);
+            texels[0][s] = l.texel(xs[s], ys[s]);
+            texels[1][s] = l.texel(x1, ys[s]);
+            texels[2][s] = l.texel(xs[s], y1);
+            texels[3][s] = l.texel(x1, y1);
+        }
+
+        const simd::float4 weight(i == 0 ? 1.0f - t : t);
+        for (int c = 0; c < 3; ++c)
+        {
+            simd::float4 top = simd::float4::from_byte_lanes(texels[0], c) * (simd::float4(1.0f) - fx)
+                             + simd::float4::from_byte_lanes(texels[1], c) * fx;
+            simd::float4 bottom = simd::float4::from_byte_lanes(texels[2], c) * (simd::float4(1.0f) - fx)
+                                + simd::float4::from_byte_lanes(texels[3], c) * fx;
+            simd::float4 blended = (top * (simd::float4(1.0f) - fy) + bottom * fy) * weight;
+            acc[c] = i == 0 ? blended : acc[c] + blended;
+        }
+    }
+
+    float r[4], g[4], b[4];
+    acc[0].store(r);
+    acc[1].store(g);
+    acc[2].store(b);
+    for (int s = 0; s < 4; ++s)
+        out[s] = Eigen::Vector3f(r[s], g[s], b[s]);
+}
@@ -5,30 +5,129 @@
 #ifndef RASTERIZER_TEXTURE_H
 #define RASTERIZER_TEXTURE_H
 #include "global.hpp"
+#include "Simd.hpp"
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
 #include <eigen3/Eigen/Eigen>
-#include <opencv2/opencv.hpp>
+
+/*
+ * The image is converted to a mip chain when it is loaded. Every level stores RGBA8 texels
+ * in 4x4 tiles, one tile is 64 bytes, so a bilinear footprint almost always stays in a single
+ * cache line. Texture coordinates are clamped to the edge. Colors are returned in [0, 255].
+ * */
 class Texture{
+public:
+    enum class Filter
+    {
+        Nearest,
+        Bilinear,
+        Trilinear
+    };
+
+    Texture(const std::string& name);
+
+    int width, height;
+
+    // Nearest texel of the full resolution image.
+    Eigen::Vector3f getColor(float u, float v) const
+    {
+        const level& l = levels[0];
+        int x = std::clamp((int)(u * l.width), 0, l.width - 1);
+        int y = std::clamp((int)((1 - v) * l.height), 0, l.height - 1);
+        return to_color(simd::float4::from_bytes(l.texel(x, y)));
+    }
+
+    Eigen::Vector3f getColorBilinear(float u, float v) const
+    {
+        return to_color(bilinear(levels[0], u, v));
+    }
+
+    // lod is the mip level, 0 is the full resolution image. Fractional levels blend the two nearest levels.
+    Eigen::Vector3f getColorTrilinear(float u, float v, float lod) const
+    {
+        return to_color(trilinear(u, v, lod));
+    }
+
+    Eigen::Vector3f sample(float u, float v, float lod, Filter filter) const
+    {
+        switch (filter)
+        {
+            case Filter::Nearest: return getColor(u, v);
+            case Filter::Bilinear: return getColorBilinear(u, v);
+            default: return getColorTrilinear(u, v, lod);
+        }
+    }
+
+    // Four trilinear samples at the same lod, same results as getColorTrilinear. Coordinates, unpacking and
+    // blending run with one sample per lane, only the texel loads are done one by one.
+    void sample4(const float u[4], const float v[4], float lod, Eigen::Vector3f out[4]) const;
+
+    // Mip level for a screen triangle with texture coordinates uv and twice the screen area screen_area2,
+    // from the ratio of covered texels to covered pixels.
+    float lod(const Eigen::Vector2f* uv, float screen_area2) const
+    {
+        Eigen::Vector2f e1 = uv[1] - uv[0], e2 = uv[2] - uv[0];
+        float texel_area2 = std::abs(e1.x() * e2.y() - e2.x() * e1.y()) * (float)width * (float)height;
+        if (!(texel_area2 > 0.0f) || !(screen_area2 > 0.0f))
+            return 0.0f;
+        return std::max(0.0f, 0.5f * std::log2(texel_area2 / screen_area2));
+    }
+
+    int level_count() const { return (int)levels.size(); }
+
 private:
-    cv::Mat image_data;
+    struct level
+    {
+        int width, height, tiles_x;
+        std::vector<uint32_t> texels;
 
-public:
-    Texture(const std::string& name)
+        uint32_t texel(int x, int y) const
+        {
+            return texels[((y >> 2) * tiles_x + (x >> 2)) * 16 + (y & 3) * 4 + (x & 3)];
+        }
+    };
+
+    std::vector<level> levels;
+
+    static Eigen::Vector3f to_color(simd::float4 c)
     {
-        image_data = cv::imread(name);
-        cv::cvtColor(image_data, image_data, cv::COLOR_RGB2BGR);
-        width = image_data.cols;
-        height = image_data.rows;
+        float rgba[4];
+        c.store(rgba);
+        return Eigen::Vector3f(rgba[0], rgba[1], rgba[2]);
     }
 
-    int width, height;
+    // Blend of the 2x2 texels around (x, y), which are texel space coordinates already clamped to the level.
+    static simd::float4 blend(const level& l, float x, float y)
+    {
+        int x0 = (int)x, y0 = (int)y;
+        int x1 = std::min(x0 + 1, l.width - 1), y1 = std::min(y0 + 1, l.height - 1);
+        float fx = x - (float)x0, fy = y - (float)y0;
 
-    Eigen::Vector3f getColor(float u, float v)
+        simd::float4 top = simd::float4::from_bytes(l.texel(x0, y0)) * simd::float4(1.0f - fx)
+                         + simd::float4::from_bytes(l.texel(x1, y0)) * simd::float4(fx);
+        simd::float4 bottom = simd::float4::from_bytes(l.texel(x0, y1)) * simd::float4(1.0f - fx)
+                            + simd::float4::from_bytes(l.texel(x1, y1)) * simd::float4(fx);
+        return top * simd::float4(1.0f - fy) + bottom * simd::float4(fy);
+    }
+
+    static simd::float4 bilinear(const level& l, float u, float v)
     {
-        auto u_img = u * width;
-        auto v_img = (1 - v) * height;
-        auto color = image_data.at<cv::Vec3b>(v_img, u_img);
-        return Eigen::Vector3f(color[0], color[1], color[2]);
+        float x = std::clamp(u * l.width - 0.5f, 0.0f, (float)(l.width - 1));
+        float y = std::clamp((1 - v) * l.height - 0.5f, 0.0f, (float)(l.height - 1));
+        return blend(l, x, y);
     }
 
+    simd::float4 trilinear(float u, float v, float lod) const
+    {
+        lod = std::clamp(lod, 0.0f, (float)(levels.size() - 1));
+        int l0 = (int)lod;
+        float t = lod - (float)l0;
+        simd::float4 c = bilinear(levels[l0], u, v);
+        if (t == 0.0f)
+            return c;
+        return c * simd::float4(1.0f - t) + bilinear(levels[l0 + 1], u, v) * simd::float4(t);
+    }
 };
 #endif //RASTERIZER_TEXTURE_H
@@ -0,0 +1,60 @@
+#include "ThreadPool.hpp"
+
+rst::thread_pool::~thread_pool()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void rst::thread_pool::dispatch(int workers, job work, const void* context)
+{
+    while ((int)threads.size() < workers - 1)
+    {
+        // Only this thread changes generation, the new thread waits for the next one.
+        const int index = (int)threads.size();
+        const uint64_t seen = generation;
+        threads.emplace_back([this, index, seen] { thread_main(index, seen); });
+    }
+
+    {
+        std::lock_guard lock(mutex);
+        current_job = work;
+        current_context = context;
+        active = workers - 1;
+        pending = workers - 1;
+        ++generation;
+    }
+    start.notify_all();
+
+    work(context, 0);
+
+    std::unique_lock lock(mutex);
+    finished.wait(lock, [this] { return pending == 0; });
+}
+
+void rst::thread_pool::thread_main(int index, uint64_t seen)
+{
+    std::unique_lock lock(mutex);
+    for (;;)
+    {
+        start.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping)
+            return;
+        seen = generation;
+        if (index >= active)
+            continue;
+
+        const job work = current_job;
+        const void* context = current_context;
+        lock.unlock();
+        work(context, index + 1);
+        lock.lock();
+        if (--pending == 0)
+            finished.notify_one();
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+// Worker threads owned by rst::rasterizer. They are started on first use and then wait for the next
+// draw call, so a frame doesn't pay for creating and joining threads.
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rst
+{
+    class thread_pool
+    {
+    public:
+        thread_pool() = default;
+        ~thread_pool();
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        // Calls work(worker) once for every worker in [0, workers) and returns when all calls are done.
+        // Worker 0 runs on the calling thread, the others on pool threads, all of them at the same time,
+        // so the calls may wait for each other, e.g. on a std::barrier.
+        template <typename Work>
+        void run(int workers, const Work& work)
+        {
+            if (workers <= 1)
+            {
+                work(0);
+                return;
+            }
+            dispatch(workers, [](const void* context, int worker) { (*static_cast<const Work*>(context))(worker); }, &work);
+        }
+
+    private:
+        using job = void (*)(const void* context, int worker);
+
+        void dispatch(int workers, job work, const void* context);
+        void thread_main(int index, uint64_t seen);
+
+        std::mutex mutex;
+        std::condition_variable start;
+        std::condition_variable finished;
+        std::vector<std::thread> threads;
+
+        // Bumped for every run, a pool thread joins a run when it sees a new generation.
+        uint64_t generation = 0;
+        job current_job = nullptr;
+        const void* current_context = nullptr;
+        // Pool threads taking part in the current run, and those of them still working.
+        int active = 0;
+        int pending = 0;
+        bool stopping = false;
+    };
+}
@@ -1,4 +1,11 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
+#include <limits>
+#include <random>
+#include <thread>
+#include <variant>
 #include <opencv2/opencv.hpp>
 
 #include "global.hpp"
@@ -6,7 +13,8 @@
 #include "Triangle.hpp"
 #include "Shader.hpp"
 #include "Texture.hpp"
-#include "OBJ_Loader.h"
+#include "Batch.hpp"
+#include "FastObjLoader.hpp"
 
 #include "Utils.hpp"
 
@@ -62,7 +70,7 @@ Eigen::Vector3f vertex_shader(const vertex_shader_payload& payload)
     return payload.position;
 }
 
-Eigen::Vector3f normal_fragment_shader(const fragment_shader_payload& payload)
+Eigen::Vector3f normal_fragment_shader(const fragment_shader_payload& payload, const shader_uniforms&)
 {
     Eigen::Vector3f return_color = (payload.normal.head<3>().normalized() + Eigen::Vector3f(1.0f, 1.0f, 1.0f)) / 2.f;
     Eigen::Vector3f result;
@@ -76,13 +84,7 @@ static Eigen::Vector3f reflect(const Eigen::Vector3f& vec, const Eigen::Vector3f
     return (2 * costheta * axis - vec).normalized();
 }
 
-struct light
-{
-    Eigen::Vector3f position;
-    Eigen::Vector3f intensity;
-};
-
-Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload& payload)
+Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload& payload, const shader_uniforms& uniforms)
 {
     Eigen::Vector3f return_color = {0, 0, 0};
     if (payload.texture)
@@ -93,18 +95,15 @@ Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload& payload)
     Eigen::Vector3f texture_color;
     texture_color << return_color.x(), return_color.y(), return_color.z();
 
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+    const Eigen::Vector3f& ka = uniforms.ka;
     Eigen::Vector3f kd = texture_color / 255.f;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
+    const Eigen::Vector3f& ks = uniforms.ks;
 
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
+    auto lights = uniforms.active_lights();
+    const Eigen::Vector3f& amb_light_intensity = uniforms.amb_light_intensity;
+    const Eigen::Vector3f& eye_pos = uniforms.eye_pos;
 
-    float p = 150;
+    float p = uniforms.p;
 
     Eigen::Vector3f color = texture_color;
     Eigen::Vector3f point = payload.view_pos;
@@ -122,20 +121,17 @@ Eigen::Vector3f texture_fragment_shader(const fragment_shader_payload& payload)
     return result_color * 255.f;
 }
 
-Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload& payload)
+Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload& payload, const shader_uniforms& uniforms)
 {
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+    const Eigen::Vector3f& ka = uniforms.ka;
     Eigen::Vector3f kd = payload.color;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
+    const Eigen::Vector3f& ks = uniforms.ks;
 
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
+    auto lights = uniforms.active_lights();
+    const Eigen::Vector3f& amb_light_intensity = uniforms.amb_light_intensity;
+    const Eigen::Vector3f& eye_pos = uniforms.eye_pos;
 
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
-
-    float p = 150;
+    float p = uniforms.p;
 
     Eigen::Vector3f color = payload.color;
     Eigen::Vector3f point = payload.view_pos;
@@ -154,27 +150,24 @@ Eigen::Vector3f phong_fragment_shader(const fragment_shader_payload& payload)
 
 
 
-Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload& payload)
+Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload& payload, const shader_uniforms& uniforms)
 {
     
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+    const Eigen::Vector3f& ka = uniforms.ka;
     Eigen::Vector3f kd = payload.color;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
+    const Eigen::Vector3f& ks = uniforms.ks;
 
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
+    auto lights = uniforms.active_lights();
+    const Eigen::Vector3f& amb_light_intensity = uniforms.amb_light_intensity;
+    const Eigen::Vector3f& eye_pos = uniforms.eye_pos;
 
-    float p = 150;
+    float p = uniforms.p;
 
     Eigen::Vector3f color = payload.color; 
     Eigen::Vector3f point = payload.view_pos;
     Eigen::Vector3f normal = payload.normal;
 
-    float kh = 0.2, kn = 0.1;
+    float kh = uniforms.kh, kn = uniforms.kn;
     
     // TODO: Implement displacement mapping here
     // Let n = normal = (x, y, z)
@@ -202,28 +195,25 @@ Eigen::Vector3f displacement_fragment_shader(const fragment_shader_payload& payl
 }
 
 
-Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload& payload)
+Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload& payload, const shader_uniforms& uniforms)
 {
     
-    Eigen::Vector3f ka = Eigen::Vector3f(0.005, 0.005, 0.005);
+    const Eigen::Vector3f& ka = uniforms.ka;
     Eigen::Vector3f kd = payload.color;
-    Eigen::Vector3f ks = Eigen::Vector3f(0.7937, 0.7937, 0.7937);
-
-    auto l1 = light{{20, 20, 20}, {500, 500, 500}};
-    auto l2 = light{{-20, 20, 0}, {500, 500, 500}};
+    const Eigen::Vector3f& ks = uniforms.ks;
 
-    std::vector<light> lights = {l1, l2};
-    Eigen::Vector3f amb_light_intensity{10, 10, 10};
-    Eigen::Vector3f eye_pos{0, 0, 10};
+    auto lights = uniforms.active_lights();
+    const Eigen::Vector3f& amb_light_intensity = uniforms.amb_light_intensity;
+    const Eigen::Vector3f& eye_pos = uniforms.eye_pos;
 
-    float p = 150;
+    float p = uniforms.p;
 
     Eigen::Vector3f color = payload.color; 
     Eigen::Vector3f point = payload.view_pos;
     Eigen::Vector3f normal = payload.normal;
 
 
-    float kh = 0.2, kn = 0.1;
+    float kh = uniforms.kh, kn = uniforms.kn;
 
     // TODO: Implement bump mapping here
     // Let n = normal = (x, y, z)
@@ -242,75 +232,407 @@ Eigen::Vector3f bump_fragment_shader(const fragment_shader_payload& payload)
     return result_color * 255.f;
 }
 
-int main(int argc, const char** argv)
+using phong_shader = static_shader<phong_fragment_shader, attribute::color | attribute::normal | attribute::view_pos>;
+using texture_shader = static_shader<texture_fragment_shader, attribute::tex_coords | attribute::normal | attribute::view_pos>;
+using normal_shader = static_shader<normal_fragment_shader, attribute::normal>;
+using bump_shader = static_shader<bump_fragment_shader>;
+using displacement_shader = static_shader<displacement_fragment_shader>;
+
+using any_shader = std::variant<phong_shader, texture_shader, normal_shader, bump_shader, displacement_shader>;
+
+bool find_shader(const std::string& name, any_shader& shader)
 {
-    std::vector<Triangle*> TriangleList;
+    if (name == "texture")
+        shader = texture_shader();
+    else if (name == "normal")
+        shader = normal_shader();
+    else if (name == "phong")
+        shader = phong_shader();
+    else if (name == "bump")
+        shader = bump_shader();
+    else if (name == "displacement")
+        shader = displacement_shader();
+    else
+        return false;
+    return true;
+}
 
-    float angle = 140.0;
-    bool command_line = false;
+struct mesh_data
+{
+    std::vector<Eigen::Vector3f> positions;
+    std::vector<Eigen::Vector3f> normals;
+    std::vector<Eigen::Vector2f> texcoords;
+    std::vector<Eigen::Vector3i> indices;
+    std::vector<Eigen::Vector3f> colors;
+};
 
-    std::string filename = "output.png";
-    objl::Loader Loader;
+// Appends the streamed meshes to mesh_data, so the loader never holds a copy of them.
+struct mesh_data_stream : objl::MeshStream
+{
+    explicit mesh_data_stream(mesh_data& data) : data(data) {}
+
+    void AddVertices(const objl::Vertex* vertices, size_t count) override
+    {
+        for(size_t i=0;i<count;++i)
+        {
+            const objl::Vertex& vert = vertices[i];
+            data.positions.emplace_back(vert.Position.X, vert.Position.Y, vert.Position.Z);
+            data.normals.emplace_back(vert.Normal.X, vert.Normal.Y, vert.Normal.Z);
+            data.texcoords.emplace_back(vert.TextureCoordinate.X, vert.TextureCoordinate.Y);
+        }
+    }
+
+    void AddIndices(const unsigned int* indices, size_t count) override
+    {
+        for(size_t i=0;i+2<count;i+=3)
+        {
+            data.indices.emplace_back(base + indices[i], base + indices[i+1], base + indices[i+2]);
+        }
+    }
+
+    void EndMesh(const std::string&, const objl::Material*) override
+    {
+        base = (int)data.positions.size();
+    }
+
+    mesh_data& data;
+    int base = 0;
+};
+
+mesh_data load_mesh(const std::string& path)
+{
+    mesh_data data;
+    objl::FastLoader Loader;
+    // The rasterizer draws indexed, so every shared vertex is transformed and stored once.
+    Loader.WeldVertices = true;
 
     // Load .obj File
-    bool loadout = Loader.LoadFile(Utils::PathFromAsset("model/spot/spot_triangulated_good.obj"));
-    for(auto mesh:Loader.LoadedMeshes)
+    mesh_data_stream stream(data);
+    Loader.StreamFile(path, stream);
+    // Vertices of faces without a triangle at the end belong to no mesh.
+    data.positions.resize(stream.base);
+    data.normals.resize(stream.base);
+    data.texcoords.resize(stream.base);
+    data.colors.assign(data.positions.size(), Eigen::Vector3f(148, 121, 92));
+    return data;
+}
+
+shader_uniforms scene_uniforms(const Eigen::Vector3f& eye_pos)
+{
+    shader_uniforms uniforms;
+    uniforms.add_light({{20, 20, 20}, {500, 500, 500}});
+    uniforms.add_light({{-20, 20, 0}, {500, 500, 500}});
+    uniforms.eye_pos = eye_pos;
+    return uniforms;
+}
+
+// Renders every frame of every job in the list. The mesh and textures are loaded once and shared,
+// each worker owns a single threaded rasterizer and renders whole frames, and a separate thread
+// encodes the PNGs.
+int run_batch(const std::string& job_path, int worker_count)
+{
+    std::vector<render_job> jobs;
+    if (!load_render_jobs(job_path, jobs))
+        return 1;
+
+    std::vector<any_shader> shaders(jobs.size());
+    std::vector<int> first_frame(jobs.size() + 1, 0);
+    for (size_t i = 0; i < jobs.size(); ++i)
     {
-        for(int i=0;i<mesh.Vertices.size();i+=3)
+        if (!find_shader(jobs[i].shader, shaders[i]))
         {
-            Triangle* t = new Triangle();
-            for(int j=0;j<3;j++)
-            {
-                t->setVertex(j,Vector4f(mesh.Vertices[i+j].Position.X,mesh.Vertices[i+j].Position.Y,mesh.Vertices[i+j].Position.Z,1.0));
-                t->setNormal(j,Vector3f(mesh.Vertices[i+j].Normal.X,mesh.Vertices[i+j].Normal.Y,mesh.Vertices[i+j].Normal.Z));
-                t->setTexCoord(j,Vector2f(mesh.Vertices[i+j].TextureCoordinate.X, mesh.Vertices[i+j].TextureCoordinate.Y));
-            }
-            TriangleList.push_back(t);
+            std::cerr << "Unknown shader " << jobs[i].shader << "\n";
+            return 1;
         }
+        first_frame[i + 1] = first_frame[i] + jobs[i].frame_count();
     }
+    const int total_frames = first_frame.back();
 
-    rst::rasterizer r(700, 700);
+    auto load_start = std::chrono::steady_clock::now();
+    const mesh_data mesh = load_mesh(Utils::PathFromAsset("model/spot/spot_triangulated_good.obj"));
+    const Texture height_map(Utils::PathFromAsset("model/spot/hmap.jpg"));
+    const Texture diffuse_map(Utils::PathFromAsset("model/spot/spot_texture.png"));
+    auto render_start = std::chrono::steady_clock::now();
 
-    r.set_texture(Texture(Utils::PathFromAsset("model/spot/hmap.jpg")));
-    std::function<Eigen::Vector3f(fragment_shader_payload)> active_shader = phong_fragment_shader;
+    const Eigen::Vector3f eye_pos = {0,0,10};
+    const shader_uniforms uniforms = scene_uniforms(eye_pos);
 
-    if (argc >= 2)
+    if (worker_count <= 0)
+        worker_count = std::max(1, (int)std::thread::hardware_concurrency());
+    worker_count = std::max(1, std::min(worker_count, total_frames));
+
+    image_writer writer(2 * worker_count);
+    std::atomic<int> next_frame = 0;
+
+    auto worker = [&]()
     {
-        command_line = true;
-        filename = std::string(argv[1]);
+        rst::rasterizer r(700, 700, rst::ColorFormat::BGRA8);
+        r.set_thread_count(1);
 
-        if (argc == 3 && std::string(argv[2]) == "texture")
+        auto pos_id = r.load_positions(mesh.positions);
+        auto ind_id = r.load_indices(mesh.indices);
+        auto col_id = r.load_colors(mesh.colors);
+        r.load_normals(mesh.normals);
+        r.load_texcoords(mesh.texcoords);
+
+        r.set_vertex_shader(vertex_shader);
+        r.set_uniforms(uniforms);
+        r.set_view(get_view_matrix(eye_pos));
+        r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
+
+        auto draw = [&](const auto& shader) { r.draw(pos_id, ind_id, col_id, shader); };
+
+        // Frames are handed out in job order, so a worker only swaps textures at job boundaries.
+        const Texture* bound_texture = nullptr;
+        for (int frame = next_frame++; frame < total_frames; frame = next_frame++)
         {
-            std::cout << "Rasterizing using the texture shader\n";
-            active_shader = texture_fragment_shader;
-            r.set_texture(Texture(Utils::PathFromAsset("model/spot/spot_texture.png")));
+            size_t job = std::upper_bound(first_frame.begin(), first_frame.end(), frame) - first_frame.begin() - 1;
+            int local_frame = frame - first_frame[job];
+
+            const Texture* texture = jobs[job].shader == "texture" ? &diffuse_map : &height_map;
+            if (texture != bound_texture)
+            {
+                r.set_texture(*texture);
+                bound_texture = texture;
+            }
+
+            jobs[job].options.apply(r);
+            r.clear(rst::Buffers::Color | rst::Buffers::Depth);
+            r.set_model(get_model_matrix(jobs[job].angle(local_frame)));
+            std::visit(draw, shaders[job]);
+
+            // frame_view() aliases the color buffer, which the next frame overwrites.
+            writer.push(jobs[job].output_path(local_frame), r.frame_view().clone());
         }
-        else if (argc == 3 && std::string(argv[2]) == "normal")
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < worker_count; ++i)
+        workers.emplace_back(worker);
+    for (auto& t : workers)
+        t.join();
+    auto render_end = std::chrono::steady_clock::now();
+
+    size_t failed = writer.finish();
+    auto write_end = std::chrono::steady_clock::now();
+
+    auto seconds = [](auto from, auto to) { return std::chrono::duration<double>(to - from).count(); };
+    double render_time = seconds(render_start, render_end);
+    double total_time = seconds(render_start, write_end);
+    std::cout << "Loaded assets in " << seconds(load_start, render_start) << " s\n";
+    std::cout << "Rendered " << total_frames << " frames from " << jobs.size() << " jobs with " << worker_count << " workers\n";
+    std::cout << "Render: " << render_time << " s, " << total_frames / render_time << " fps\n";
+    std::cout << "Render and write: " << total_time << " s, " << total_frames / total_time << " fps\n";
+
+    return failed ? 1 : 0;
+}
+
+// Loads every model with objl::Loader, with objl::FastLoader parsing the text and with FastLoader reading
+// its binary cache, checks that all three produce the same meshes and prints the best time of each out of repeats runs.
+int run_loader_benchmark(int repeats, const std::vector<std::string>& extra_paths)
+{
+    std::vector<std::string> paths;
+    for (const char* model : {"model/bunnyAssignment3/bunny.obj", "model/spot/spot_triangulated_good.obj", "model/spot/spot_quadrangulated.obj",
+                              "model/spot/spot_control_mesh.obj", "model/rock/rock.obj", "model/Crate/Crate1.obj", "model/cube/cube.obj",
+                              "model/cornellbox/floor.obj", "model/cornellbox/shortbox.obj", "model/cornellbox/tallbox.obj",
+                              "model/cornellbox/left.obj", "model/cornellbox/right.obj", "model/cornellbox/light.obj"})
+        paths.push_back(Utils::PathFromAsset(model));
+    paths.insert(paths.end(), extra_paths.begin(), extra_paths.end());
+    repeats = std::max(1, repeats);
+
+    auto best_ms = [&](auto& loader, const std::string& path)
+    {
+        double best = std::numeric_limits<double>::infinity();
+        for (int i = 0; i < repeats; ++i)
         {
-            std::cout << "Rasterizing using the normal shader\n";
-            active_shader = normal_fragment_shader;
+            auto start = std::chrono::steady_clock::now();
+            loader.LoadFile(path);
+            best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
         }
-        else if (argc == 3 && std::string(argv[2]) == "phong")
+        return best;
+    };
+
+    auto same_vertex = [](const objl::Vertex& a, const objl::Vertex& b)
+    {
+        return a.Position == b.Position && a.Normal == b.Normal && a.TextureCoordinate == b.TextureCoordinate;
+    };
+
+    int mismatches = 0;
+    double old_total = 0, new_total = 0, cached_total = 0;
+    for (const auto& path : paths)
+    {
+        objl::Loader old_loader;
+        objl::FastLoader new_loader, cached_loader;
+        new_loader.UseCache = false;
+        double old_ms = best_ms(old_loader, path);
+        double new_ms = best_ms(new_loader, path);
+        // The first run writes the cache if it's missing or stale.
+        cached_loader.LoadFile(path);
+        double cached_ms = best_ms(cached_loader, path);
+        old_total += old_ms;
+        new_total += new_ms;
+        cached_total += cached_ms;
+
+        auto same_as_old = [&](const objl::FastLoader& loader)
         {
-            std::cout << "Rasterizing using the phong shader\n";
-            active_shader = phong_fragment_shader;
+            bool same = old_loader.LoadedMeshes.size() == loader.LoadedMeshes.size() &&
+                        std::equal(old_loader.LoadedVertices.begin(), old_loader.LoadedVertices.end(), loader.LoadedVertices.begin(), loader.LoadedVertices.end(), same_vertex) &&
+                        old_loader.LoadedIndices == loader.LoadedIndices;
+            for (size_t i = 0; same && i < old_loader.LoadedMeshes.size(); ++i)
+            {
+                const auto& a = old_loader.LoadedMeshes[i];
+                const auto& b = loader.LoadedMeshes[i];
+                same = a.MeshName == b.MeshName && a.Indices == b.Indices &&
+                       std::equal(a.Vertices.begin(), a.Vertices.end(), b.Vertices.begin(), b.Vertices.end(), same_vertex);
+            }
+            return same;
+        };
+        bool same = same_as_old(new_loader) && same_as_old(cached_loader);
+        mismatches += !same;
+
+        std::cout << path << ": " << new_loader.LoadedIndices.size() / 3 << " triangles, Loader " << old_ms << " ms, FastLoader "
+                  << new_ms << " ms (" << old_ms / new_ms << "x), " << (cached_loader.LoadedFromCache ? "cached " : "cache not written, ")
+                  << cached_ms << " ms (" << old_ms / cached_ms << "x)" << (same ? "" : ", MISMATCH") << "\n";
+    }
+    std::cout << "Total: Loader " << old_total << " ms, FastLoader " << new_total << " ms (" << old_total / new_total << "x), cached "
+              << cached_total << " ms (" << old_total / cached_total << "x)\n";
+
+    return mismatches ? 1 : 0;
+}
+
+// Triangulates generated polygons of vertex_count and a tenth as many corners, the ratio of the two times
+// shows how the triangulation scales. Every result is checked to cover the polygon exactly once.
+int run_triangulation_benchmark(int vertex_count)
+{
+    vertex_count = std::max(40, vertex_count);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> random_radius(0.3f, 1.0f);
+
+    int failures = 0;
+    for (const char* shape : {"convex", "star", "random"})
+    {
+        double previous_ms = 0;
+        for (int n : {vertex_count / 10, vertex_count})
+        {
+            // Radius per corner around the origin, in a tilted plane so the projection is tested as well.
+            std::vector<Eigen::Vector2f> outline(n);
+            std::vector<objl::Vertex> polygon(n);
+            for (int i = 0; i < n; ++i)
+            {
+                float radius = 1.0f;
+                if (std::string(shape) == "star")
+                    radius = i % 2 ? 0.5f : 1.0f;
+                else if (std::string(shape) == "random")
+                    radius = random_radius(rng);
+                float angle = 2 * MY_PI * i / n;
+                outline[i] = radius * Eigen::Vector2f(std::cos(angle), std::sin(angle));
+                polygon[i].Position = objl::Vector3(outline[i].x(), 0.6f * outline[i].y(), 0.8f * outline[i].y());
+            }
+
+            std::vector<unsigned int> indices;
+            double best_ms = std::numeric_limits<double>::infinity();
+            for (int repeat = 0; repeat < 3; ++repeat)
+            {
+                indices.clear();
+                auto start = std::chrono::steady_clock::now();
+                objl::Loader::VertexTriangluation(indices, polygon);
+                best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+
+            auto signed_area = [](const Eigen::Vector2f& a, const Eigen::Vector2f& b, const Eigen::Vector2f& c)
+            {
+                return 0.5 * ((double)(b.x() - a.x()) * (c.y() - a.y()) - (double)(b.y() - a.y()) * (c.x() - a.x()));
+            };
+            double polygon_area = 0, triangle_area = 0;
+            bool same_winding = true;
+            for (int i = 0; i < n; ++i)
+                polygon_area += signed_area(Eigen::Vector2f::Zero(), outline[i], outline[(i + 1) % n]);
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                double area = signed_area(outline[indices[i]], outline[indices[i + 1]], outline[indices[i + 2]]);
+                same_winding = same_winding && area >= -1e-9;
+                triangle_area += area;
+            }
+            bool ok = indices.size() == 3 * size_t(n - 2) && same_winding && std::abs(triangle_area - polygon_area) < 1e-4 * polygon_area;
+            failures += !ok;
+
+            std::cout << shape << " polygon, " << n << " vertices: " << best_ms << " ms";
+            if (previous_ms > 0)
+                std::cout << " (" << best_ms / previous_ms << "x the time for 10x the vertices)";
+            std::cout << (ok ? "" : ", WRONG TRIANGULATION") << "\n";
+            previous_ms = best_ms;
         }
-        else if (argc == 3 && std::string(argv[2]) == "bump")
+    }
+    return failures ? 1 : 0;
+}
+
+int main(int argc, const char** argv)
+{
+    // Assignment3 --batch <job list> [worker count], see Batch.hpp for the job list format.
+    if (argc >= 3 && std::string(argv[1]) == "--batch")
+        return run_batch(argv[2], argc >= 4 ? std::atoi(argv[3]) : 0);
+
+    // Assignment3 --bench-loader [repeats] [extra .obj files...]
+    if (argc >= 2 && std::string(argv[1]) == "--bench-loader")
+        return run_loader_benchmark(argc >= 3 ? std::atoi(argv[2]) : 5, std::vector<std::string>(argv + std::min(argc, 3), argv + argc));
+
+    // Assignment3 --bench-triangulation [polygon vertex count]
+    if (argc >= 2 && std::string(argv[1]) == "--bench-triangulation")
+        return run_triangulation_benchmark(argc >= 3 ? std::atoi(argv[2]) : 10000);
+
+    // Assignment3 [--<render option>...] [output file] [shader], see render_options for the option words.
+    render_options options;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+            args.push_back(arg);
+        else if (!parse_render_option(arg.substr(2), options))
         {
-            std::cout << "Rasterizing using the bump shader\n";
-            active_shader = bump_fragment_shader;
+            std::cerr << "Unknown option " << arg << "\n";
+            return 1;
         }
-        else if (argc == 3 && std::string(argv[2]) == "displacement")
+    }
+
+    float angle = 140.0;
+    bool command_line = false;
+
+    std::string filename = "output.png";
+
+    const mesh_data mesh = load_mesh(Utils::PathFromAsset("model/spot/spot_triangulated_good.obj"));
+
+    rst::rasterizer r(700, 700, rst::ColorFormat::BGRA8);
+
+    auto pos_id = r.load_positions(mesh.positions);
+    auto ind_id = r.load_indices(mesh.indices);
+    auto col_id = r.load_colors(mesh.colors);
+    r.load_normals(mesh.normals);
+    r.load_texcoords(mesh.texcoords);
+
+    r.set_texture(Texture(Utils::PathFromAsset("model/spot/hmap.jpg")));
+    any_shader active_shader = phong_shader();
+
+    if (!args.empty())
+    {
+        command_line = true;
+        filename = args[0];
+
+        if (args.size() == 2 && find_shader(args[1], active_shader))
         {
-            std::cout << "Rasterizing using the bump shader\n";
-            active_shader = displacement_fragment_shader;
+            std::cout << "Rasterizing using the " << args[1] << " shader\n";
+            if (args[1] == "texture")
+                r.set_texture(Texture(Utils::PathFromAsset("model/spot/spot_texture.png")));
         }
     }
 
     Eigen::Vector3f eye_pos = {0,0,10};
 
     r.set_vertex_shader(vertex_shader);
-    r.set_fragment_shader(active_shader);
+    r.set_uniforms(scene_uniforms(eye_pos));
+    options.apply(r);
+
+    auto draw = [&](const auto& shader) { r.draw(pos_id, ind_id, col_id, shader); };
 
     int key = 0;
     int frame_count = 0;
@@ -322,10 +644,10 @@ int main(int argc, const char** argv)
         r.set_view(get_view_matrix(eye_pos));
         r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
-        r.draw(TriangleList);
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
-        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        std::visit(draw, active_shader);
+        if constexpr (rst::stats_enabled)
+            std::cout << r.get_draw_stats().to_json() << "\n";
+        cv::Mat image = r.frame_view();
 
         cv::imwrite(filename, image);
 
@@ -340,11 +662,8 @@ int main(int argc, const char** argv)
         r.set_view(get_view_matrix(eye_pos));
         r.set_projection(get_projection_matrix(45.0, 1, 0.1, 50));
 
-        //r.draw(pos_id, ind_id, col_id, rst::Primitive::Triangle);
-        r.draw(TriangleList);
-        cv::Mat image(700, 700, CV_32FC3, r.frame_buffer().data());
-        image.convertTo(image, CV_8UC3, 1.0f);
-        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+        std::visit(draw, active_shader);
+        cv::Mat image = r.frame_view();
 
         cv::imshow("image", image);
         cv::imwrite(filename, image);
@@ -3,6 +3,7 @@
 //
 
 #include <algorithm>
+#include <thread>
 #include "rasterizer.hpp"
 #include <opencv2/opencv.hpp>
 #include <math.h>
@@ -12,6 +13,7 @@ rst::pos_buf_id rst::rasterizer::load_positions(const std::vector<Eigen::Vector3
 {
     auto id = get_next_id();
     pos_buf.emplace(id, positions);
+    pos_blocks.emplace(id, to_blocks(positions));
 
     return {id};
 }
@@ -36,12 +38,23 @@ rst::col_buf_id rst::rasterizer::load_normals(const std::vector<Eigen::Vector3f>
 {
     auto id = get_next_id();
     nor_buf.emplace(id, normals);
+    nor_blocks.emplace(id, to_blocks(normals));
 
     normal_id = id;
 
     return {id};
 }
 
+rst::col_buf_id rst::rasterizer::load_texcoords(const std::vector<Eigen::Vector2f>& texcoords)
+{
+    auto id = get_next_id();
+    tex_buf.emplace(id, texcoords);
+
+    texcoord_id = id;
+
+    return {id};
+}
+
 
 // Bresenham's line drawing algorithm
 void rst::rasterizer::draw_line(Eigen::Vector3f begin, Eigen::Vector3f end)
@@ -149,138 +162,315 @@ auto to_vec4(const Eigen::Vector3f& v3, float w = 1.0f)
     return Vector4f(v3.x(), v3.y(), v3.z(), w);
 }
 
-static bool insideTriangle(int x, int y, const Vector4f* _v){
-    Vector3f v[3];
-    for(int i=0;i<3;i++)
-        v[i] = {_v[i].x(),_v[i].y(), 1.0};
-    Vector3f f0,f1,f2;
-    f0 = v[1].cross(v[0]);
-    f1 = v[2].cross(v[1]);
-    f2 = v[0].cross(v[2]);
-    Vector3f p(x,y,1.);
-    if((p.dot(f0)*f0.dot(v[2])>0) && (p.dot(f1)*f1.dot(v[0])>0) && (p.dot(f2)*f2.dot(v[1])>0))
-        return true;
-    return false;
+rst::rasterizer::vertex_uniforms rst::rasterizer::get_uniforms() const
+{
+    vertex_uniforms u;
+    u.f1 = (50 - 0.1) / 2.0;
+    u.f2 = (50 + 0.1) / 2.0;
+    u.model_view = view * model;
+    u.mvp = projection * u.model_view;
+    u.normal_matrix = u.model_view.inverse().transpose();
+    // The camera looks down -z, w = projection(3, 2) * z + projection(3, 3).
+    u.front_sign = projection(3, 2) > 0 ? -1.0f : 1.0f;
+    return u;
 }
 
-static std::tuple<float, float, float> computeBarycentric2D(float x, float y, const Vector4f* v){
-    float c1 = (x*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*y + v[1].x()*v[2].y() - v[2].x()*v[1].y()) / (v[0].x()*(v[1].y() - v[2].y()) + (v[2].x() - v[1].x())*v[0].y() + v[1].x()*v[2].y() - v[2].x()*v[1].y());
-    float c2 = (x*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*y + v[2].x()*v[0].y() - v[0].x()*v[2].y()) / (v[1].x()*(v[2].y() - v[0].y()) + (v[0].x() - v[2].x())*v[1].y() + v[2].x()*v[0].y() - v[0].x()*v[2].y());
-    float c3 = (x*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*y + v[0].x()*v[1].y() - v[1].x()*v[0].y()) / (v[2].x()*(v[0].y() - v[1].y()) + (v[1].x() - v[0].x())*v[2].y() + v[0].x()*v[1].y() - v[1].x()*v[0].y());
-    return {c1,c2,c3};
+Eigen::Vector4f rst::rasterizer::to_screen(const vertex_uniforms& u, const Eigen::Vector4f& clip) const
+{
+    Eigen::Vector4f v = clip;
+    //Homogeneous division
+    v.x() /= v.w();
+    v.y() /= v.w();
+    v.z() /= v.w();
+
+    //Viewport transformation
+    v.x() = 0.5*width*(v.x()+1.0);
+    v.y() = 0.5*height*(v.y()+1.0);
+    v.z() = v.z() * u.f1 + u.f2;
+
+    return v;
 }
 
-void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList) {
+rst::rasterizer::transformed_vertex rst::rasterizer::transform_vertex(const vertex_uniforms& u, const Eigen::Vector4f& pos, const Eigen::Vector3f& normal) const
+{
+    transformed_vertex out;
+    out.view_pos = (u.model_view * pos).head<3>();
+    out.normal = (u.normal_matrix * to_vec4(normal, 0.0f)).head<3>();
+
+    out.clip_pos = u.mvp * pos;
+    out.screen_pos = to_screen(u, out.clip_pos);
+    return out;
+}
+
+std::vector<rst::rasterizer::vector_block> rst::rasterizer::to_blocks(const std::vector<Eigen::Vector3f>& v)
+{
+    std::vector<vector_block> blocks((v.size() + simd::WIDTH - 1) / simd::WIDTH, vector_block{});
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        vector_block& b = blocks[i / simd::WIDTH];
+        b.x[i % simd::WIDTH] = v[i].x();
+        b.y[i % simd::WIDTH] = v[i].y();
+        b.z[i % simd::WIDTH] = v[i].z();
+    }
+    return blocks;
+}
 
-    float f1 = (50 - 0.1) / 2.0;
-    float f2 = (50 + 0.1) / 2.0;
+void rst::rasterizer::transform_block(const vertex_uniforms& u, const vector_block& pos, const vector_block* normal, vertex_block& out) const
+{
+    using simd::float8;
 
-    Eigen::Matrix4f mvp = projection * view * model;
-    for (const auto& t:TriangleList)
+    // Row r of m times (x, y, z, w) for all lanes at once.
+    auto row = [](const Eigen::Matrix4f& m, int r, float8 x, float8 y, float8 z, float w)
     {
-        Triangle newtri = *t;
+        return float8(m(r, 0)) * x + float8(m(r, 1)) * y + float8(m(r, 2)) * z + float8(m(r, 3) * w);
+    };
 
-        std::array<Eigen::Vector4f, 3> mm {
-                (view * model * t->v[0]),
-                (view * model * t->v[1]),
-                (view * model * t->v[2])
-        };
+    const float8 x = float8::load(pos.x), y = float8::load(pos.y), z = float8::load(pos.z);
 
-        std::array<Eigen::Vector3f, 3> viewspace_pos;
+    float8 clip[4];
+    for (int r = 0; r < 4; ++r)
+    {
+        clip[r] = row(u.mvp, r, x, y, z, 1.0f);
+        clip[r].store(out.clip[r]);
+    }
+    for (int r = 0; r < 3; ++r)
+        row(u.model_view, r, x, y, z, 1.0f).store(out.view[r]);
 
-        std::transform(mm.begin(), mm.end(), viewspace_pos.begin(), [](auto& v) {
-            return v.template head<3>();
-        });
+    //Homogeneous division and viewport transformation
+    const float8 one(1.0f);
+    const float8 inv_w = one / clip[3];
+    (float8(0.5f * width) * (clip[0] * inv_w + one)).store(out.screen[0]);
+    (float8(0.5f * height) * (clip[1] * inv_w + one)).store(out.screen[1]);
+    (clip[2] * inv_w * float8(u.f1) + float8(u.f2)).store(out.screen[2]);
 
-        Eigen::Vector4f v[] = {
-                mvp * t->v[0],
-                mvp * t->v[1],
-                mvp * t->v[2]
-        };
-        //Homogeneous division
-        for (auto& vec : v) {
-            vec.x()/=vec.w();
-            vec.y()/=vec.w();
-            vec.z()/=vec.w();
-        }
+    if (!normal)
+    {
+        for (int r = 0; r < 3; ++r)
+            float8(0.0f).store(out.normal[r]);
+        return;
+    }
+
+    const float8 nx = float8::load(normal->x), ny = float8::load(normal->y), nz = float8::load(normal->z);
+    for (int r = 0; r < 3; ++r)
+        row(u.normal_matrix, r, nx, ny, nz, 0.0f).store(out.normal[r]);
+}
+
+rst::rasterizer::screen_triangle rst::rasterizer::transform_triangle(const vertex_uniforms& u, const Triangle& t) const
+{
+    screen_triangle result{t, {}, {}};
+    Triangle& newtri = result.tri;
+
+    for (int i = 0; i < 3; ++i)
+    {
+        transformed_vertex vert = transform_vertex(u, t.v[i], t.normal[i]);
+        //screen space coordinates
+        newtri.setVertex(i, vert.screen_pos);
+        //view space normal
+        newtri.setNormal(i, vert.normal);
+        result.view_pos[i] = vert.view_pos;
+        result.clip_pos[i] = vert.clip_pos;
+    }
+
+    newtri.setColor(0, 148,121.0,92.0);
+    newtri.setColor(1, 148,121.0,92.0);
+    newtri.setColor(2, 148,121.0,92.0);
+
+    return result;
+}
 
-        Eigen::Matrix4f inv_trans = (view * model).inverse().transpose();
-        Eigen::Vector4f n[] = {
-                inv_trans * to_vec4(t->normal[0], 0.0f),
-                inv_trans * to_vec4(t->normal[1], 0.0f),
-                inv_trans * to_vec4(t->normal[2], 0.0f)
+namespace
+{
+    // Vertex of a polygon being clipped, everything which is interpolated linearly in clip space.
+    struct clip_vertex
+    {
+        Eigen::Vector4f clip, screen;
+        Eigen::Vector3f view_pos, normal, color;
+        Eigen::Vector2f tex_coords;
+        bool original;
+    };
+
+    clip_vertex lerp(const clip_vertex& a, const clip_vertex& b, float t)
+    {
+        return {
+            a.clip + t * (b.clip - a.clip),
+            Eigen::Vector4f::Zero(),
+            a.view_pos + t * (b.view_pos - a.view_pos),
+            a.normal + t * (b.normal - a.normal),
+            a.color + t * (b.color - a.color),
+            a.tex_coords + t * (b.tex_coords - a.tex_coords),
+            false
         };
+    }
 
-        //Viewport transformation
-        for (auto & vert : v)
+    // Sutherland-Hodgman against one plane, distance(v) >= 0 is inside.
+    template <typename Distance>
+    int clip_polygon(const clip_vertex* in, int count, clip_vertex* out, Distance distance)
+    {
+        int n = 0;
+        for (int i = 0; i < count; ++i)
         {
-            vert.x() = 0.5*width*(vert.x()+1.0);
-            vert.y() = 0.5*height*(vert.y()+1.0);
-            vert.z() = vert.z() * f1 + f2;
+            const clip_vertex& a = in[i];
+            const clip_vertex& b = in[(i + 1) % count];
+            float da = distance(a.clip), db = distance(b.clip);
+            if (da >= 0)
+                out[n++] = a;
+            if ((da >= 0) != (db >= 0))
+                out[n++] = lerp(a, b, da / (da - db));
         }
+        return n;
+    }
+}
 
-        for (int i = 0; i < 3; ++i)
-        {
-            //screen space coordinates
-            newtri.setVertex(i, v[i]);
-        }
+bool rst::rasterizer::culled(float area) const
+{
+    switch (cull_mode)
+    {
+        case CullMode::Back: return area < 0;
+        case CullMode::Front: return area > 0;
+        default: return false;
+    }
+}
+
+int rst::rasterizer::clip_triangle(const vertex_uniforms& u, const screen_triangle& t, bool guard, clip_stats& stats, screen_triangle* out) const
+{
+    // Every plane adds at most one vertex.
+    constexpr int MAX_VERTICES = 3 + 5;
+    clip_vertex poly[MAX_VERTICES], tmp[MAX_VERTICES];
+    for (int i = 0; i < 3; ++i)
+    {
+        poly[i] = {t.clip_pos[i], t.tri.v[i], t.view_pos[i], t.tri.normal[i], t.tri.color[i], t.tri.tex_coords[i], true};
+    }
 
-        for (int i = 0; i < 3; ++i)
+    // Planes in the frame where w is positive in front of the camera.
+    const float s = u.front_sign, g = guard_band, near_w = near_plane;
+    int count = clip_polygon(poly, 3, tmp, [&](const Eigen::Vector4f& c) { return s * c.w() - near_w; });
+    if (count < 3)
+        return 0;
+    std::copy(tmp, tmp + count, poly);
+
+    if (guard)
+    {
+        ++stats.guard_band_clipped;
+        auto plane = [&](int axis, float sign)
         {
-            //view space normal
-            newtri.setNormal(i, n[i].head<3>());
-        }
+            count = clip_polygon(poly, count, tmp, [&](const Eigen::Vector4f& c) { return s * (g * c.w() + sign * c[axis]); });
+            std::copy(tmp, tmp + count, poly);
+        };
+        plane(0, 1.0f);
+        plane(0, -1.0f);
+        plane(1, 1.0f);
+        plane(1, -1.0f);
+        if (count < 3)
+            return 0;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (!poly[i].original)
+            poly[i].screen = to_screen(u, poly[i].clip);
+    }
 
-        newtri.setColor(0, 148,121.0,92.0);
-        newtri.setColor(1, 148,121.0,92.0);
-        newtri.setColor(2, 148,121.0,92.0);
+    // The clipped polygon is planar and convex, its winding decides the facing.
+    float area = 0;
+    for (int i = 1; i + 1 < count; ++i)
+        area += detail::signed_area(poly[0].screen, poly[i].screen, poly[i + 1].screen);
+    if (culled(area))
+    {
+        ++stats.backface_culled;
+        return 0;
+    }
 
-        // Also pass view space vertice position
-        rasterize_triangle(newtri, viewspace_pos);
+    int n = 0;
+    for (int i = 1; i + 1 < count; ++i)
+    {
+        screen_triangle& r = out[n++];
+        r.tri = t.tri;
+        for (int k = 0; k < 3; ++k)
+        {
+            const clip_vertex& v = poly[k == 0 ? 0 : i + k - 1];
+            r.tri.v[k] = v.screen;
+            r.tri.normal[k] = v.normal;
+            r.tri.color[k] = v.color;
+            r.tri.tex_coords[k] = v.tex_coords;
+            r.view_pos[k] = v.view_pos;
+            r.clip_pos[k] = v.clip;
+        }
     }
+    return n;
 }
 
-static Eigen::Vector3f interpolate(float alpha, float beta, float gamma, const Eigen::Vector3f& vert1, const Eigen::Vector3f& vert2, const Eigen::Vector3f& vert3, float weight)
+const rst::rasterizer::screen_triangle& rst::rasterizer::assembled_triangle(uint32_t id) const
 {
-    return (alpha * vert1 + beta * vert2 + gamma * vert3) / weight;
+    size_t list = std::upper_bound(assembled_offset.begin(), assembled_offset.end(), id) - assembled_offset.begin() - 1;
+    return assembled[list][id - assembled_offset[list]];
 }
 
-static Eigen::Vector2f interpolate(float alpha, float beta, float gamma, const Eigen::Vector2f& vert1, const Eigen::Vector2f& vert2, const Eigen::Vector2f& vert3, float weight)
+// Mip level used for all fragments of a screen triangle.
+float rst::rasterizer::triangle_lod(const Triangle& t) const
 {
-    auto u = (alpha * vert1[0] + beta * vert2[0] + gamma * vert3[0]);
-    auto v = (alpha * vert1[1] + beta * vert2[1] + gamma * vert3[1]);
+    if (!texture)
+        return 0.0f;
 
-    u /= weight;
-    v /= weight;
+    const Eigen::Vector4f* v = t.v;
+    float screen_area2 = std::abs((v[1].x() - v[0].x()) * (v[2].y() - v[0].y()) - (v[2].x() - v[0].x()) * (v[1].y() - v[0].y()));
+    return texture->lod(t.tex_coords, screen_area2);
+}
 
-    return Eigen::Vector2f(u, v);
+// Pixels whose centers may be covered by the triangle, clipped against clip.
+rst::rasterizer::rect rst::rasterizer::bounding_rect(const Triangle& t, const rect& clip)
+{
+    const Eigen::Vector4f* v = t.v;
+    float min_x = std::floor(std::min({v[0].x(), v[1].x(), v[2].x()}));
+    float max_x = std::ceil(std::max({v[0].x(), v[1].x(), v[2].x()}));
+    float min_y = std::floor(std::min({v[0].y(), v[1].y(), v[2].y()}));
+    float max_y = std::ceil(std::max({v[0].y(), v[1].y(), v[2].y()}));
+
+    // Clamp in float first, the vertices can be far outside of the screen.
+    return {
+        (int)std::max((float)clip.x0, min_x),
+        (int)std::max((float)clip.y0, min_y),
+        (int)std::min((float)clip.x1, max_x + 1.0f),
+        (int)std::min((float)clip.y1, max_y + 1.0f)
+    };
 }
 
-//Screen space rasterization
-void rst::rasterizer::rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& view_pos) 
+int rst::rasterizer::worker_count() const
 {
-    // TODO: From your HW3, get the triangle rasterization code.
-    // TODO: Inside your rasterization loop:
-    //    * v[i].w() is the vertex view space depth value z.
-    //    * Z is interpolated view space depth for the current pixel
-    //    * zp is depth between zNear and zFar, used for z-buffer
+    if (thread_count > 0)
+        return thread_count;
+    return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+void rst::rasterizer::draw(std::vector<Triangle *> &TriangleList) {
 
-    // float Z = 1.0 / (alpha / v[0].w() + beta / v[1].w() + gamma / v[2].w());
-    // float zp = alpha * v[0].z() / v[0].w() + beta * v[1].z() / v[1].w() + gamma * v[2].z() / v[2].w();
-    // zp *= Z;
+    draw(TriangleList, function_shader{fragment_shader});
+}
+
+void rst::rasterizer::draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type)
+{
+    if (type == Primitive::Triangle)
+    {
+        draw(pos_buffer, ind_buffer, col_buffer, function_shader{fragment_shader});
+        return;
+    }
 
-    // TODO: Interpolate the attributes:
-    // auto interpolated_color
-    // auto interpolated_normal
-    // auto interpolated_texcoords
-    // auto interpolated_shadingcoords
+    const auto& blocks = pos_blocks[pos_buffer.pos_id];
+    const auto& ind = ind_buf[ind_buffer.ind_id];
+    const vertex_uniforms u = get_uniforms();
 
-    // Use: fragment_shader_payload payload( interpolated_color, interpolated_normal.normalized(), interpolated_texcoords, texture ? &*texture : nullptr);
-    // Use: payload.view_pos = interpolated_shadingcoords;
-    // Use: Instead of passing the triangle's color directly to the frame buffer, pass the color to the shaders first to get the final color;
-    // Use: auto pixel_color = fragment_shader(payload);
+    vertex_cache.resize(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i)
+        transform_block(u, blocks[i], nullptr, vertex_cache[i]);
 
- 
+    for (const auto& i : ind)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            const Eigen::Vector4f a = cached_vertex(i[k]).screen_pos;
+            const Eigen::Vector4f b = cached_vertex(i[(k + 1) % 3]).screen_pos;
+            draw_line(a.head<3>(), b.head<3>());
+        }
+    }
 }
 
 void rst::rasterizer::set_model(const Eigen::Matrix4f& m)
@@ -302,32 +492,85 @@ void rst::rasterizer::clear(rst::Buffers buff)
 {
     if ((buff & rst::Buffers::Color) == rst::Buffers::Color)
     {
-        std::fill(frame_buf.begin(), frame_buf.end(), Eigen::Vector3f{0, 0, 0});
+        frame_buf.clear();
     }
     if ((buff & rst::Buffers::Depth) == rst::Buffers::Depth)
     {
         std::fill(depth_buf.begin(), depth_buf.end(), std::numeric_limits<float>::infinity());
+        std::fill(hiz_buf.begin(), hiz_buf.end(), std::numeric_limits<float>::infinity());
     }
 }
 
-rst::rasterizer::rasterizer(int w, int h) : width(w), height(h)
+rst::rasterizer::rasterizer(int w, int h, ColorFormat format) : width(w), height(h)
 {
-    frame_buf.resize(w * h);
+    frame_buf.resize(w, h, format);
     depth_buf.resize(w * h);
 
+    hiz_blocks_x = (w + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    hiz_blocks_y = (h + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    hiz_buf.resize(hiz_blocks_x * hiz_blocks_y);
+    vis_buf.resize(w * h);
+
     texture = std::nullopt;
 }
 
 int rst::rasterizer::get_index(int x, int y)
 {
-    return (height-y)*width + x;
+    return (height-1-y)*width + x;
 }
 
 void rst::rasterizer::set_pixel(const Vector2i &point, const Eigen::Vector3f &color)
 {
+    if (point.x() < 0 || point.x() >= width || point.y() < 0 || point.y() >= height)
+        return;
+
     //old index: auto ind = point.y() + point.x() * width;
-    int ind = (height-point.y())*width + point.x();
-    frame_buf[ind] = color;
+    int ind = (height-1-point.y())*width + point.x();
+    frame_buf.store(ind, color);
+}
+
+void rst::render_target::resize(int w, int h, ColorFormat f)
+{
+    width = w;
+    height = h;
+    pixels = w * h;
+    fmt = f;
+
+    const bool float_format = fmt == ColorFormat::RGB32F || fmt == ColorFormat::RGB32F_Planar;
+    floats.resize(float_format ? (size_t)pixels * 3 : 0);
+    bytes.resize(fmt == ColorFormat::BGRA8 ? (size_t)pixels * 4 : 0);
+    halves.resize(fmt == ColorFormat::RGB16F ? (size_t)pixels * 3 : 0);
+    // Give back the memory of the previous format.
+    floats.shrink_to_fit();
+    bytes.shrink_to_fit();
+    halves.shrink_to_fit();
+    clear();
+}
+
+void rst::render_target::clear()
+{
+    std::fill(floats.begin(), floats.end(), 0.0f);
+    std::fill(halves.begin(), halves.end(), cv::float16_t());
+    for (size_t i = 0; i < bytes.size(); i += 4)
+    {
+        bytes[i] = bytes[i + 1] = bytes[i + 2] = 0;
+        bytes[i + 3] = 255;
+    }
+}
+
+cv::Mat rst::render_target::view()
+{
+    switch (fmt)
+    {
+        case ColorFormat::BGRA8:
+            return cv::Mat(height, width, CV_8UC4, bytes.data());
+        case ColorFormat::RGB32F_Planar:
+            return cv::Mat(height * 3, width, CV_32FC1, floats.data());
+        case ColorFormat::RGB16F:
+            return cv::Mat(height, width, CV_16FC3, halves.data());
+        default:
+            return cv::Mat(height, width, CV_32FC3, floats.data());
+    }
 }
 
 void rst::rasterizer::set_vertex_shader(std::function<Eigen::Vector3f(vertex_shader_payload)> vert_shader)
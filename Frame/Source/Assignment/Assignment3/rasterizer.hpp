@@ -5,10 +5,16 @@
 #pragma once
 
 #include <eigen3/Eigen/Eigen>
+#include <opencv2/core.hpp>
 #include <optional>
 #include <algorithm>
+#include <array>
+#include <vector>
 #include "global.hpp"
 #include "Shader.hpp"
+#include "Simd.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
 #include "Triangle.hpp"
 
 using namespace Eigen;
@@ -57,14 +63,144 @@ namespace rst
         int col_id = 0;
     };
 
+    enum class ColorFormat
+    {
+        RGB32F,        // 3 floats per pixel in RGB order
+        BGRA8,         // 4 packed bytes per pixel in OpenCV's channel order, alpha is always 255
+        RGB32F_Planar, // one float plane per channel, R plane first
+        RGB16F         // 3 half floats per pixel in RGB order
+    };
+
+    /*
+     * Color buffer of the rasterizer. Shaded colors (0 - 255) are converted to the selected
+     * format when they are written, so the buffer can be handed to OpenCV without a conversion pass.
+     * */
+    class render_target
+    {
+    public:
+        using sample_type = Eigen::Vector3f;
+
+        void resize(int w, int h, ColorFormat f);
+        void clear();
+
+        // Zero copy view over the buffer: CV_32FC3, CV_8UC4, CV_32FC1 with the three planes
+        // stacked vertically, or CV_16FC3.
+        cv::Mat view();
+
+        ColorFormat format() const { return fmt; }
+
+        void store(int ind, const Eigen::Vector3f& color)
+        {
+            switch (fmt)
+            {
+                case ColorFormat::RGB32F:
+                {
+                    float* p = floats.data() + ind * 3;
+                    p[0] = color.x();
+                    p[1] = color.y();
+                    p[2] = color.z();
+                    break;
+                }
+                case ColorFormat::BGRA8:
+                {
+                    uint8_t* p = bytes.data() + ind * 4;
+                    p[0] = cv::saturate_cast<uint8_t>(color.z());
+                    p[1] = cv::saturate_cast<uint8_t>(color.y());
+                    p[2] = cv::saturate_cast<uint8_t>(color.x());
+                    p[3] = 255;
+                    break;
+                }
+                case ColorFormat::RGB32F_Planar:
+                {
+                    float* p = floats.data() + ind;
+                    p[0] = color.x();
+                    p[pixels] = color.y();
+                    p[2 * pixels] = color.z();
+                    break;
+                }
+                case ColorFormat::RGB16F:
+                {
+                    cv::float16_t* p = halves.data() + ind * 3;
+                    p[0] = cv::float16_t(color.x());
+                    p[1] = cv::float16_t(color.y());
+                    p[2] = cv::float16_t(color.z());
+                    break;
+                }
+            }
+        }
+
+    private:
+        // Storage of the current format, the other two vectors are empty: floats for RGB32F and
+        // RGB32F_Planar, bytes for BGRA8, halves for RGB16F.
+        std::vector<float> floats;
+        std::vector<uint8_t> bytes;
+        std::vector<cv::float16_t> halves;
+        int width = 0, height = 0, pixels = 0;
+        ColorFormat fmt = ColorFormat::RGB32F;
+    };
+
+    enum class CullMode
+    {
+        None,
+        Back,
+        Front
+    };
+
+    // What the primitive assembly stage did with the triangles of the last draw call.
+    struct clip_stats
+    {
+        uint32_t input = 0;
+        uint32_t frustum_rejected = 0;
+        uint32_t backface_culled = 0;
+        uint32_t near_clipped = 0;
+        uint32_t guard_band_clipped = 0;
+        // Triangles sent to the rasterizer, clipping can split one input triangle into several.
+        uint32_t output = 0;
+
+        clip_stats& operator+=(const clip_stats& o)
+        {
+            input += o.input;
+            frustum_rejected += o.frustum_rejected;
+            backface_culled += o.backface_culled;
+            near_clipped += o.near_clipped;
+            guard_band_clipped += o.guard_band_clipped;
+            output += o.output;
+            return *this;
+        }
+    };
+
+    // Per pixel record of the visibility buffer: the triangle of the draw call which covers the pixel.
+    // The second pass evaluates the triangle's attribute planes at the pixel center.
+    struct visibility_sample
+    {
+        static constexpr uint32_t NONE = 0xffffffff;
+
+        uint32_t id;
+    };
+
+    /*
+     * Screen is split into TILE_SIZE x TILE_SIZE tiles for the binned renderer.
+     * Each worker owns the color / depth memory of the tile it is working on,
+     * so no locks are needed while rasterizing.
+     * */
+    constexpr int TILE_SIZE = 32;
+
+    /*
+     * The hierarchical z-buffer keeps the farthest depth of every HIZ_BLOCK x HIZ_BLOCK pixel block.
+     * A block whose stored farthest depth is nearer than the nearest point of a triangle cannot be
+     * touched by that triangle and is skipped before any per pixel work.
+     * */
+    constexpr int HIZ_BLOCK = 8;
+
     class rasterizer
     {
     public:
-        rasterizer(int w, int h);
+        rasterizer(int w, int h, ColorFormat format = ColorFormat::RGB32F);
         pos_buf_id load_positions(const std::vector<Eigen::Vector3f>& positions);
         ind_buf_id load_indices(const std::vector<Eigen::Vector3i>& indices);
         col_buf_id load_colors(const std::vector<Eigen::Vector3f>& colors);
         col_buf_id load_normals(const std::vector<Eigen::Vector3f>& normals);
+        col_buf_id load_texcoords(const std::vector<Eigen::Vector2f>& texcoords);
 
         void set_model(const Eigen::Matrix4f& m);
         void set_view(const Eigen::Matrix4f& v);
@@ -75,19 +211,173 @@ namespace rst
         void set_vertex_shader(std::function<Eigen::Vector3f(vertex_shader_payload)> vert_shader);
         void set_fragment_shader(std::function<Eigen::Vector3f(fragment_shader_payload)> frag_shader);
 
+        // Lights, material and eye position handed to every fragment shader call.
+        void set_uniforms(const shader_uniforms& u) { uniforms = u; }
+
         void set_pixel(const Vector2i &point, const Eigen::Vector3f &color);
 
+        // Bin triangles into screen tiles and rasterize the tiles on worker threads, which the rasterizer
+        // keeps between draw calls.
+        // The result is identical to the serial path.
+        void set_tile_rendering(bool enabled) { tile_rendering = enabled; }
+        // 0 means one worker per hardware thread.
+        void set_thread_count(int count) { thread_count = std::max(0, count); }
+
+        // Deferred shading: rasterize only triangle ids and barycentrics into a visibility buffer,
+        // then run the fragment shader once per covered pixel on all workers.
+        // Overdraw no longer costs shading work. The result is identical to forward shading.
+        void set_deferred_shading(bool enabled) { deferred_shading = enabled; }
+
+        // Snaps vertices to 1/256 pixel and tests coverage with exact integer edge functions and the
+        // top-left rule, see fixed_edge_equations. Shared edges are then watertight and coverage
+        // doesn't depend on the compiler's float code generation.
+        void set_fixed_point(bool enabled) { fixed_point = enabled; }
+
+        // Primitive assembly, run on every triangle before rasterization:
+        //   * triangles entirely outside one side of the view frustum are rejected,
+        //   * triangles facing away (Back) or towards (Front) the camera are culled,
+        //     counter clockwise on screen is front facing,
+        //   * triangles crossing the near plane are clipped in homogeneous space,
+        //   * triangles reaching outside the guard band are clipped to it, all others are rasterized
+        //     unclipped and only limited by their bounding box.
+        // The near plane is given as a distance in front of the camera, the guard band in multiples of
+        // the half screen size.
+        void set_cull_mode(CullMode mode) { cull_mode = mode; }
+        void set_near_plane(float distance) { near_plane = distance; }
+        void set_guard_band(float size) { guard_band = std::max(1.0f, size); }
+        const clip_stats& get_clip_stats() const { return last_clip_stats; }
+
+        // Timing and counters of the last draw call, see Stats.hpp.
+        const draw_stats& get_draw_stats() const { return last_draw_stats; }
+
         void clear(Buffers buff);
 
+        // Indexed draw. Every vertex of the position buffer is transformed once into the vertex cache,
+        // triangles are then assembled from the index buffer. Normals and texture coordinates come from
+        // the last load_normals / load_texcoords calls, if any.
         void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, Primitive type);
         void draw(std::vector<Triangle *> &TriangleList);
 
-        std::vector<Eigen::Vector3f>& frame_buffer() { return frame_buf; }
+        // Same as above with the fragment shader given as a type instead of the std::function set by
+        // set_fragment_shader. Shader is any callable as
+        //   Eigen::Vector3f (const fragment_shader_payload&, const shader_uniforms&)
+        // and gets inlined into the pixel loop.
+        template <typename Shader>
+        void draw(pos_buf_id pos_buffer, ind_buf_id ind_buffer, col_buf_id col_buffer, const Shader& shader);
+        template <typename Shader>
+        void draw(std::vector<Triangle *> &TriangleList, const Shader& shader);
+
+        // The frame buffer in the format given to the constructor, no copy is made.
+        cv::Mat frame_view() { return frame_buf.view(); }
 
     private:
+        // Screen space triangle with its view space and clip space vertex positions.
+        struct screen_triangle
+        {
+            Triangle tri;
+            std::array<Eigen::Vector3f, 3> view_pos;
+            std::array<Eigen::Vector4f, 3> clip_pos;
+        };
+
+        // Matrices shared by every vertex of a draw call.
+        struct vertex_uniforms
+        {
+            Eigen::Matrix4f mvp;
+            Eigen::Matrix4f model_view;
+            Eigen::Matrix4f normal_matrix;
+            float f1, f2;
+            // +1 if clip space w is positive in front of the camera, -1 if it is negative.
+            float front_sign;
+        };
+
+        // One vertex after the vertex stage.
+        struct transformed_vertex
+        {
+            Eigen::Vector4f clip_pos;
+            Eigen::Vector4f screen_pos;
+            Eigen::Vector3f view_pos;
+            Eigen::Vector3f normal;
+        };
+
+        // Positions or normals of simd::WIDTH consecutive vertices as structure of arrays, the input of
+        // the vertex stage. The last block of a buffer is padded with zeros.
+        struct vector_block
+        {
+            float x[simd::WIDTH], y[simd::WIDTH], z[simd::WIDTH];
+        };
+
+        // Output of the vertex stage for simd::WIDTH consecutive vertices, one array per component.
+        struct vertex_block
+        {
+            float clip[4][simd::WIDTH];
+            // Screen x, y and depth, screen w is clip w.
+            float screen[3][simd::WIDTH];
+            float view[3][simd::WIDTH];
+            float normal[3][simd::WIDTH];
+        };
+
+        // Largest number of triangles clipping can turn one triangle into.
+        static constexpr int MAX_CLIPPED_TRIANGLES = 6;
+
+        // Adapts the std::function fragment shader to the shader type interface of the templated draw.
+        struct function_shader
+        {
+            const std::function<Eigen::Vector3f(fragment_shader_payload)>& shade;
+
+            Eigen::Vector3f operator()(const fragment_shader_payload& payload, const shader_uniforms&) const
+            {
+                return shade(payload);
+            }
+        };
+
+        // Integer pixel rectangle, [x0, x1) x [y0, y1).
+        struct rect
+        {
+            int x0, y0, x1, y1;
+        };
+
         void draw_line(Eigen::Vector3f begin, Eigen::Vector3f end);
 
-        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos);
+        vertex_uniforms get_uniforms() const;
+        transformed_vertex transform_vertex(const vertex_uniforms& u, const Eigen::Vector4f& pos, const Eigen::Vector3f& normal) const;
+        // The vertex stage of the indexed draw: transforms a block of vertices in one pass, every SIMD lane is one vertex.
+        void transform_block(const vertex_uniforms& u, const vector_block& pos, const vector_block* normal, vertex_block& out) const;
+        static std::vector<vector_block> to_blocks(const std::vector<Eigen::Vector3f>& v);
+        transformed_vertex cached_vertex(size_t i) const;
+        screen_triangle transform_triangle(const vertex_uniforms& u, const Triangle& t) const;
+        static rect bounding_rect(const Triangle& t, const rect& clip);
+
+        float triangle_lod(const Triangle& t) const;
+        Eigen::Vector4f to_screen(const vertex_uniforms& u, const Eigen::Vector4f& clip) const;
+
+        // Primitive assembly, calls emit(screen_triangle&&) for every triangle left to rasterize.
+        template <typename Emit>
+        void setup_triangle(const vertex_uniforms& u, screen_triangle&& t, clip_stats& stats, Emit&& emit) const;
+        // Clips t against the near plane and, if guard is set, the guard band. Returns the number of
+        // front facing triangles written to out.
+        int clip_triangle(const vertex_uniforms& u, const screen_triangle& t, bool guard, clip_stats& stats, screen_triangle* out) const;
+        bool culled(float signed_area) const;
+
+        // shade_block(i) fills vertex_cache[i], assemble(i, stats, emit) runs triangle i through primitive assembly.
+        template <typename Shader, typename VertexStage, typename Assemble>
+        void draw_triangles(const Shader& shader, size_t block_count, VertexStage shade_block, size_t triangle_count, Assemble assemble);
+        // Output is the frame buffer, or the visibility buffer in deferred shading mode.
+        template <typename Shader, typename Output, typename VertexStage, typename Assemble>
+        void draw_serial(const Shader& shader, Output& output, size_t block_count, VertexStage shade_block, size_t triangle_count, Assemble assemble);
+        template <typename Shader, typename Output, typename VertexStage, typename Assemble>
+        void draw_tiled(const Shader& shader, Output& output, size_t block_count, VertexStage shade_block, size_t triangle_count, Assemble assemble);
+        template <typename Shader>
+        void resolve_visibility(const Shader& shader);
+        int worker_count() const;
+
+        template <typename Shader, typename View>
+        void rasterize_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos, uint32_t id, const rect& bounds, View& view, const Shader& shader, draw_stats& stats);
+        // rasterize_triangle with the coverage test of Edges, edge_equations or fixed_edge_equations.
+        template <typename Edges, typename Shader, typename View>
+        void scan_triangle(const Triangle& t, const std::array<Eigen::Vector3f, 3>& world_pos, uint32_t id, const rect& bounds, View& view, const Shader& shader, draw_stats& stats);
+        // Shades one lane of the attribute planes evaluated for 8 pixels, see detail::attribute_planes.
+        template <typename Shader>
+        Eigen::Vector3f shade_fragment(const float (*values)[simd::WIDTH], int lane, float tex_lod, const Shader& shader);
 
         // VERTEX SHADER -> MVP -> Clipping -> /.W -> VIEWPORT -> DRAWLINE/DRAWTRI -> FRAGSHADER
 
@@ -97,24 +387,55 @@ namespace rst
         Eigen::Matrix4f projection;
 
         int normal_id = -1;
+        int texcoord_id = -1;
 
         std::map<int, std::vector<Eigen::Vector3f>> pos_buf;
         std::map<int, std::vector<Eigen::Vector3i>> ind_buf;
         std::map<int, std::vector<Eigen::Vector3f>> col_buf;
         std::map<int, std::vector<Eigen::Vector3f>> nor_buf;
+        std::map<int, std::vector<Eigen::Vector2f>> tex_buf;
+        // Positions and normals again as structure of arrays, for the vertex stage.
+        std::map<int, std::vector<vector_block>> pos_blocks;
+        std::map<int, std::vector<vector_block>> nor_blocks;
+
+        // Post transform vertex cache of the indexed draw, kept to reuse its memory between frames.
+        std::vector<vertex_block> vertex_cache;
+        // Screen triangles of the current draw, one list per worker, used by the tiled path and deferred shading.
+        // Triangle ids count through the lists in order, list i starts at assembled_offset[i].
+        std::vector<std::vector<screen_triangle>> assembled;
+        std::vector<uint32_t> assembled_offset;
+        const screen_triangle& assembled_triangle(uint32_t id) const;
 
         std::optional<Texture> texture;
 
         std::function<Eigen::Vector3f(fragment_shader_payload)> fragment_shader;
         std::function<Eigen::Vector3f(vertex_shader_payload)> vertex_shader;
+        shader_uniforms uniforms;
 
-        std::vector<Eigen::Vector3f> frame_buf;
+        render_target frame_buf;
         std::vector<float> depth_buf;
+        std::vector<float> hiz_buf;
+        std::vector<visibility_sample> vis_buf;
+        int hiz_blocks_x, hiz_blocks_y;
         int get_index(int x, int y);
 
         int width, height;
 
+        bool tile_rendering = false;
+        bool deferred_shading = false;
+        bool fixed_point = false;
+
+        CullMode cull_mode = CullMode::None;
+        float near_plane = 0.1f;
+        float guard_band = 8.0f;
+        clip_stats last_clip_stats;
+        draw_stats last_draw_stats;
+        int thread_count = 0;
+        thread_pool pool;
+
         int next_id = 0;
         int get_next_id() { return next_id++; }
     };
 }
+
+#include "Pipeline.hpp"
@@ -0,0 +1,63 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+BVH::BVH(const std::vector<Bounds3>& bounds, int maxPrimsInNode)
+{
+    if (bounds.empty())
+        return;
+
+    maxPrimsInNode = std::clamp(maxPrimsInNode, 1, 255);
+    std::vector<Vector3f> centroids(bounds.size());
+    for (size_t i = 0; i < bounds.size(); ++i)
+        centroids[i] = bounds[i].Centroid();
+
+    primitives.resize(bounds.size());
+    std::iota(primitives.begin(), primitives.end(), 0u);
+    nodes.reserve(2 * bounds.size() / maxPrimsInNode + 1);
+    recursiveBuild(bounds, centroids, 0, (uint32_t)bounds.size(), maxPrimsInNode);
+}
+
+uint32_t BVH::recursiveBuild(const std::vector<Bounds3>& bounds, const std::vector<Vector3f>& centroids,
+                             uint32_t begin, uint32_t end, int maxPrimsInNode)
+{
+    const uint32_t index = (uint32_t)nodes.size();
+    nodes.emplace_back();
+
+    Bounds3 nodeBounds, centroidBounds;
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        nodeBounds = Union(nodeBounds, bounds[primitives[i]]);
+        centroidBounds = Union(centroidBounds, centroids[primitives[i]]);
+    }
+    nodes[index].bounds = nodeBounds;
+
+    const int dim = centroidBounds.maxExtent();
+    auto coordinate = [dim](const Vector3f& v) { return dim == 0 ? v.x : dim == 1 ? v.y : v.z; };
+
+    // Primitives with the same centroid can't be told apart by splitting, they stay in one leaf.
+    if (end - begin <= (uint32_t)maxPrimsInNode ||
+        coordinate(centroidBounds.pMax) <= coordinate(centroidBounds.pMin))
+    {
+        nodes[index].offset = begin;
+        nodes[index].count = (uint16_t)std::min<uint32_t>(end - begin, UINT16_MAX);
+        nodes[index].axis = 0;
+        if (end - begin <= UINT16_MAX)
+            return index;
+        // Too many to count in one leaf, split them in half anyway.
+        nodes[index].count = 0;
+    }
+
+    // Split at the median centroid along the longest axis.
+    const uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(primitives.begin() + begin, primitives.begin() + middle, primitives.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return coordinate(centroids[a]) < coordinate(centroids[b]); });
+
+    recursiveBuild(bounds, centroids, begin, middle, maxPrimsInNode);
+    const uint32_t second = recursiveBuild(bounds, centroids, middle, end, maxPrimsInNode);
+    nodes[index].offset = second;
+    nodes[index].count = 0;
+    nodes[index].axis = (uint16_t)dim;
+    return index;
+}
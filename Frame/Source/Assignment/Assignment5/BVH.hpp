@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Bounds3.hpp"
+#include "Vector.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy over primitives given only by their bounds, so the same structure serves the
+// Scene (one primitive per object) and MeshTriangle (one per triangle). Intersecting the primitives
+// themselves is up to the caller.
+//
+// Nodes are stored depth first in one array, the first child of an interior node directly follows it.
+class BVH
+{
+public:
+    BVH() = default;
+    // Primitive i is bounds[i].
+    explicit BVH(const std::vector<Bounds3>& bounds, int maxPrimsInNode = 4);
+
+    bool Empty() const { return nodes.empty(); }
+    Bounds3 WorldBound() const { return nodes.empty() ? Bounds3() : nodes[0].bounds; }
+
+    // Calls hit(primitive, tMax) for the primitives in the leaves the ray passes through before tMax, nearest
+    // leaves first. When hit finds an intersection it lowers tMax to its distance, nodes behind it are skipped.
+    template <typename Hit>
+    void Intersect(const Vector3f& orig, const Vector3f& dir, float tMax, const Hit& hit) const;
+
+    // Any hit query for shadow rays. Calls hit(primitive) for the primitives in the leaves the ray passes through
+    // before tMax, in no particular order, and returns true as soon as one call does.
+    template <typename Hit>
+    bool IntersectP(const Vector3f& orig, const Vector3f& dir, float tMax, const Hit& hit) const;
+
+private:
+    struct Node
+    {
+        Bounds3 bounds;
+        // Leaves: first entry in primitives. Interior nodes: index of the second child.
+        uint32_t offset;
+        // Primitives in a leaf, 0 for interior nodes.
+        uint16_t count;
+        // Axis the children were split on, the child on the lower side comes first.
+        uint16_t axis;
+    };
+
+    // Shared by both queries. visit(primitive, tMax) returns true to end the traversal.
+    template <typename Visit>
+    bool Traverse(const Vector3f& orig, const Vector3f& dir, float tMax, const Visit& visit) const;
+
+    uint32_t recursiveBuild(const std::vector<Bounds3>& bounds, const std::vector<Vector3f>& centroids,
+                            uint32_t begin, uint32_t end, int maxPrimsInNode);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> primitives;
+};
+
+template <typename Hit>
+void BVH::Intersect(const Vector3f& orig, const Vector3f& dir, float tMax, const Hit& hit) const
+{
+    Traverse(orig, dir, tMax, [&](uint32_t primitive, float& t)
+    {
+        hit(primitive, t);
+        return false;
+    });
+}
+
+template <typename Hit>
+bool BVH::IntersectP(const Vector3f& orig, const Vector3f& dir, float tMax, const Hit& hit) const
+{
+    return Traverse(orig, dir, tMax, [&](uint32_t primitive, float&) { return hit(primitive); });
+}
+
+template <typename Visit>
+bool BVH::Traverse(const Vector3f& orig, const Vector3f& dir, float tMax, const Visit& visit) const
+{
+    if (nodes.empty())
+        return false;
+
+    const Vector3f invDir(1 / dir.x, 1 / dir.y, 1 / dir.z);
+    const bool dirIsNeg[3] = {dir.x < 0, dir.y < 0, dir.z < 0};
+
+    // Depth is bounded by the build, which halves the primitives at every level.
+    uint32_t stack[64];
+    int stackSize = 0;
+    uint32_t current = 0;
+    for (;;)
+    {
+        const Node& node = nodes[current];
+        float tEnter;
+        if (node.bounds.IntersectP(orig, invDir, tMax, tEnter))
+        {
+            if (node.count > 0)
+            {
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                {
+                    if (visit(primitives[i], tMax))
+                        return true;
+                }
+            }
+            else
+            {
+                // Visit the child on the side the ray comes from first.
+                if (dirIsNeg[node.axis])
+                {
+                    stack[stackSize++] = current + 1;
+                    current = node.offset;
+                }
+                else
+                {
+                    stack[stackSize++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stackSize == 0)
+            return false;
+        current = stack[--stackSize];
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Vector.hpp"
+#include "global.hpp"
+
+#include <algorithm>
+#include <limits>
+
+// Axis aligned bounding box. A default constructed box is empty and grows with Union.
+class Bounds3
+{
+public:
+    Bounds3()
+        : pMin(kInfinity)
+        , pMax(-kInfinity)
+    {}
+    Bounds3(const Vector3f& p)
+        : pMin(p)
+        , pMax(p)
+    {}
+    Bounds3(const Vector3f& p1, const Vector3f& p2)
+        : pMin(std::min(p1.x, p2.x), std::min(p1.y, p2.y), std::min(p1.z, p2.z))
+        , pMax(std::max(p1.x, p2.x), std::max(p1.y, p2.y), std::max(p1.z, p2.z))
+    {}
+
+    Vector3f Diagonal() const { return pMax - pMin; }
+    Vector3f Centroid() const { return 0.5f * (pMin + pMax); }
+
+    int maxExtent() const
+    {
+        Vector3f d = Diagonal();
+        if (d.x > d.y && d.x > d.z)
+            return 0;
+        else if (d.y > d.z)
+            return 1;
+        else
+            return 2;
+    }
+
+    // Slab test against the part of the ray between 0 and tMax. On a hit, tEnter is where the ray enters the box.
+    bool IntersectP(const Vector3f& orig, const Vector3f& invDir, float tMax, float& tEnter) const
+    {
+        float t0 = 0, t1 = tMax;
+        if (!Slab(pMin.x, pMax.x, orig.x, invDir.x, t0, t1) ||
+            !Slab(pMin.y, pMax.y, orig.y, invDir.y, t0, t1) ||
+            !Slab(pMin.z, pMax.z, orig.z, invDir.z, t0, t1))
+            return false;
+        tEnter = t0;
+        return true;
+    }
+
+    Vector3f pMin, pMax;
+
+private:
+    static bool Slab(float lo, float hi, float o, float invD, float& t0, float& t1)
+    {
+        // Rounding can put the exit slightly before a hit on the box surface, widen it a little.
+        constexpr float PADDING = 1 + 3 * std::numeric_limits<float>::epsilon();
+
+        float tNear = (lo - o) * invD;
+        float tFar = (hi - o) * invD;
+        if (tNear > tFar)
+            std::swap(tNear, tFar);
+        tFar *= PADDING;
+        // Written so that a NaN, from a ray in the plane of a slab, leaves the interval as it is.
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar < t1 ? tFar : t1;
+        return t0 <= t1;
+    }
+};
+
+inline Bounds3 Union(const Bounds3& b1, const Bounds3& b2)
+{
+    Bounds3 ret;
+    ret.pMin = Vector3f(std::min(b1.pMin.x, b2.pMin.x), std::min(b1.pMin.y, b2.pMin.y), std::min(b1.pMin.z, b2.pMin.z));
+    ret.pMax = Vector3f(std::max(b1.pMax.x, b2.pMax.x), std::max(b1.pMax.y, b2.pMax.y), std::max(b1.pMax.z, b2.pMax.z));
+    return ret;
+}
+
+inline Bounds3 Union(const Bounds3& b, const Vector3f& p)
+{
+    return Union(b, Bounds3(p));
+}
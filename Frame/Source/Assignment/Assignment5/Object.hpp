@@ -1,5 +1,6 @@
 #pragma once
 
+#include "Bounds3.hpp"
 #include "Vector.hpp"
 #include "global.hpp"
 
@@ -19,9 +20,22 @@ public:
 
     virtual bool intersect(const Vector3f&, const Vector3f&, float&, uint32_t&, Vector2f&) const = 0;
 
+    // Whether the ray hits the object closer than tMax. Shadow rays only need this, objects that can answer it
+    // cheaper than intersect override it.
+    virtual bool intersectP(const Vector3f& orig, const Vector3f& dir, float tMax) const
+    {
+        float tNear = kInfinity;
+        uint32_t index;
+        Vector2f uv;
+        return intersect(orig, dir, tNear, index, uv) && tNear < tMax;
+    }
+
     virtual void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t&, const Vector2f&, Vector3f&,
                                       Vector2f&) const = 0;
 
+    // Box around everything intersect can hit, used to build the Scene's BVH.
+    virtual Bounds3 getBounds() const = 0;
+
     virtual Vector3f evalDiffuseColor(const Vector2f&) const
     {
         return diffuseColor;
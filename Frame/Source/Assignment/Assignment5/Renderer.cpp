@@ -1,7 +1,11 @@
 #include <fstream>
 #include "Vector.hpp"
 #include "Renderer.hpp"
+#include "FixedStack.hpp"
 #include "Scene.hpp"
+#include "TileScheduler.hpp"
+#include <algorithm>
+#include <mutex>
 #include <optional>
 
 #include <Utils.hpp>
@@ -75,7 +79,7 @@ float fresnel(const Vector3f &I, const Vector3f &N, const float &ior)
 //
 // \param orig is the ray origin
 // \param dir is the ray direction
-// \param objects is the list of objects the scene contains
+// \param scene is the scene, its BVH is used to skip objects the ray can't hit
 // \param[out] tNear contains the distance to the cloesest intersected object.
 // \param[out] index stores the index of the intersect triangle if the interesected object is a mesh.
 // \param[out] uv stores the u and v barycentric coordinates of the intersected point
@@ -84,131 +88,284 @@ float fresnel(const Vector3f &I, const Vector3f &N, const float &ior)
 // [/comment]
 std::optional<hit_payload> trace(
         const Vector3f &orig, const Vector3f &dir,
-        const std::vector<std::unique_ptr<Object> > &objects)
+        const Scene &scene)
 {
-    float tNear = kInfinity;
+    const auto &objects = scene.get_objects();
     std::optional<hit_payload> payload;
-    for (const auto & object : objects)
+    uint32_t hitIndex = 0;
+    auto hit = [&](uint32_t i, float &tNear)
     {
         float tNearK = kInfinity;
         uint32_t indexK;
         Vector2f uvK;
-        if (object->intersect(orig, dir, tNearK, indexK, uvK) && tNearK < tNear)
+        // On a tie the object added first wins, whatever order the BVH visits them in.
+        if (objects[i]->intersect(orig, dir, tNearK, indexK, uvK) &&
+            (tNearK < tNear || (tNearK == tNear && payload && i < hitIndex)))
         {
             payload.emplace();
-            payload->hit_obj = object.get();
+            payload->hit_obj = objects[i].get();
             payload->tNear = tNearK;
             payload->index = indexK;
             payload->uv = uvK;
             tNear = tNearK;
+            hitIndex = i;
         }
+    };
+
+    if (scene.get_bvh().Empty())
+    {
+        // No BVH built, test every object.
+        float tNear = kInfinity;
+        for (uint32_t i = 0; i < objects.size(); ++i)
+            hit(i, tNear);
+    }
+    else
+    {
+        scene.get_bvh().Intersect(orig, dir, kInfinity, hit);
     }
 
     return payload;
 }
 
+// [comment]
+// Returns true if any object blocks the ray before maxDistance. Used for shadow rays, which don't
+// need to know the closest hit: the search stops at the first blocker and no payload is built.
+// [/comment]
+bool occluded(
+        const Vector3f &orig, const Vector3f &dir, float maxDistance,
+        const Scene &scene)
+{
+    const auto &objects = scene.get_objects();
+    if (scene.get_bvh().Empty())
+    {
+        // No BVH built, test every object.
+        for (const auto &object : objects)
+        {
+            if (object->intersectP(orig, dir, maxDistance))
+                return true;
+        }
+        return false;
+    }
+
+    return scene.get_bvh().IntersectP(orig, dir, maxDistance, [&](uint32_t i)
+    {
+        return objects[i]->intersectP(orig, dir, maxDistance);
+    });
+}
+
+// [comment]
+// castRay walks the ray tree with an explicit stack of tasks instead of recursion. A TRACE task is
+// a pending ray segment with its path weight. Tracing it pushes either its color or, on a
+// reflective surface, the tasks for the reflected and refracted rays and a task that combines
+// their colors once they are known. Colors are combined in the same order and with the same
+// expressions as the recursive version did, so the results are bit for bit the same.
+//
+// A TRACE task doesn't depend on any color, so the TRACE tasks of one bounce could also be
+// collected across pixels and intersected as a batch before they are shaded.
+// [/comment]
+struct RayTask
+{
+    enum Kind
+    {
+        // Trace orig + t * dir and shade the hit.
+        TRACE,
+        // A ray that isn't cast, its color is black.
+        SKIP,
+        // Pop the refraction and reflection colors, push reflection * kr + refraction * (1 - kr).
+        MIX,
+        // Pop a color, push color * kr.
+        SCALE
+    };
+
+    Kind kind;
+    float kr;
+    Vector3f orig, dir;
+    int depth;
+    float weight;
+
+    static RayTask Trace(const Vector3f &orig, const Vector3f &dir, int depth, float weight)
+    {
+        return {TRACE, 0, orig, dir, depth, weight};
+    }
+    static RayTask Skip() { return {SKIP, 0, {}, {}, 0, 0}; }
+    static RayTask Mix(float kr) { return {MIX, kr, {}, {}, 0, 0}; }
+    static RayTask Scale(float kr) { return {SCALE, kr, {}, {}, 0, 0}; }
+};
+
+// Deepest reflection or refraction castRay follows, a larger scene.maxDepth is clamped to it.
+constexpr int MAX_RAY_DEPTH = 16;
+
+// Work space of castRay for one pixel. Every level of the ray tree leaves at most two tasks, a MIX
+// and the refraction ray, and one color waiting for its sibling on the stacks.
+struct RayStack
+{
+    FixedStack<RayTask, 2 * MAX_RAY_DEPTH + 3> tasks;
+    FixedStack<Vector3f, MAX_RAY_DEPTH + 2> colors;
+};
+
 // [comment]
 // Implementation of the Whitted-style light transport algorithm (E [S*] (D|G) L)
 //
-// This function is the function that compute the color at the intersection point
-// of a ray defined by a position and a direction. Note that thus function is recursive (it calls itself).
+// This function computes the color at the intersection point of the ray of a TRACE task.
 //
 // If the material of the intersected object is either reflective or reflective and refractive,
-// then we compute the reflection/refraction direction and cast two new rays into the scene
-// by calling the castRay() function recursively. When the surface is transparent, we mix
-// the reflection and refraction color using the result of the fresnel equations (it computes
-// the amount of reflection and refraction depending on the surface normal, incident view direction
-// and surface refractive index).
+// then we compute the reflection/refraction direction and push the tasks for the new rays. When
+// the surface is transparent, we mix the reflection and refraction color using the result of the
+// fresnel equations (it computes the amount of reflection and refraction depending on the surface
+// normal, incident view direction and surface refractive index).
 //
 // If the surface is diffuse/glossy we use the Phong illumation model to compute the color
 // at the intersection point.
+//
+// The weight of a task is how much its color contributes to the pixel, at most 1. Reflection and
+// refraction rays that would contribute less than scene.minPathWeight are not cast, they add no
+// color. Every ray cast is counted in stats.
+// [/comment]
+void shade(
+        const RayTask &ray, const std::optional<hit_payload> &payload, const Scene &scene,
+        int maxDepth, RayStack &stack, RayStats &stats)
+{
+    if (!payload) {
+        stack.colors.Push(scene.backgroundColor);
+        return;
+    }
+
+    const Vector3f &orig = ray.orig;
+    const Vector3f &dir = ray.dir;
+    // Follows a reflected or refracted ray with factor k, unless it's too deep or its path weight is too small.
+    auto pushSecondary = [&](const Vector3f &rayOrig, const Vector3f &rayDir, float k)
+    {
+        if (ray.depth + 1 > maxDepth) {
+            stack.tasks.Push(RayTask::Skip());
+        }
+        else if (ray.weight * k < scene.minPathWeight) {
+            ++stats.prunedRays;
+            stack.tasks.Push(RayTask::Skip());
+        }
+        else {
+            stack.tasks.Push(RayTask::Trace(rayOrig, rayDir, ray.depth + 1, ray.weight * k));
+        }
+    };
+
+    Vector3f hitPoint = orig + dir * payload->tNear;
+    Vector3f N; // normal
+    Vector2f st; // st coordinates
+    payload->hit_obj->getSurfaceProperties(hitPoint, dir, payload->index, payload->uv, N, st);
+    switch (payload->hit_obj->materialType) {
+        case REFLECTION_AND_REFRACTION:
+        {
+            Vector3f reflectionDirection = normalize(reflect(dir, N));
+            Vector3f refractionDirection = normalize(refract(dir, N, payload->hit_obj->ior));
+            Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0) ?
+                                         hitPoint - N * scene.epsilon :
+                                         hitPoint + N * scene.epsilon;
+            Vector3f refractionRayOrig = (dotProduct(refractionDirection, N) < 0) ?
+                                         hitPoint - N * scene.epsilon :
+                                         hitPoint + N * scene.epsilon;
+            float kr = fresnel(dir, N, payload->hit_obj->ior);
+            // Popped in reverse: the reflection is traced first, then the refraction, then they are mixed.
+            stack.tasks.Push(RayTask::Mix(kr));
+            pushSecondary(refractionRayOrig, refractionDirection, 1 - kr);
+            pushSecondary(reflectionRayOrig, reflectionDirection, kr);
+            break;
+        }
+        case REFLECTION:
+        {
+            float kr = fresnel(dir, N, payload->hit_obj->ior);
+            Vector3f reflectionDirection = reflect(dir, N);
+            Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0) ?
+                                         hitPoint + N * scene.epsilon :
+                                         hitPoint - N * scene.epsilon;
+            stack.tasks.Push(RayTask::Scale(kr));
+            pushSecondary(reflectionRayOrig, reflectionDirection, kr);
+            break;
+        }
+        default:
+        {
+            // [comment]
+            // We use the Phong illumation model int the default case. The phong model
+            // is composed of a diffuse and a specular reflection component.
+            // [/comment]
+            Vector3f lightAmt = 0, specularColor = 0;
+            Vector3f shadowPointOrig = (dotProduct(dir, N) < 0) ?
+                                       hitPoint + N * scene.epsilon :
+                                       hitPoint - N * scene.epsilon;
+            // [comment]
+            // Loop over all lights in the scene and sum their contribution up
+            // We also apply the lambert cosine law
+            // [/comment]
+            for (auto& light : scene.get_lights()) {
+                Vector3f lightDir = light->position - hitPoint;
+                // square of the distance between hitPoint and the light
+                float lightDistance2 = dotProduct(lightDir, lightDir);
+                lightDir = normalize(lightDir);
+                float LdotN = std::max(0.f, dotProduct(lightDir, N));
+                // is the point in shadow, is there any occluding object closer to the object than the light itself?
+                bool inShadow = occluded(shadowPointOrig, lightDir, std::sqrt(lightDistance2), scene);
+                ++stats.shadowRays;
+
+                lightAmt += inShadow ? 0 : light->intensity * LdotN;
+                Vector3f reflectionDirection = reflect(-lightDir, N);
+
+                specularColor += powf(std::max(0.f, -dotProduct(reflectionDirection, dir)),
+                    payload->hit_obj->specularExponent) * light->intensity;
+            }
+
+            stack.colors.Push(lightAmt * payload->hit_obj->evalDiffuseColor(st) * payload->hit_obj->Kd + specularColor * payload->hit_obj->Ks);
+            break;
+        }
+    }
+}
+
+// [comment]
+// Computes the color seen along a primary ray by working through the tasks of its ray tree, see
+// RayTask. The stacks live in fixed size arrays, so a pixel never allocates.
 // [/comment]
 Vector3f castRay(
         const Vector3f &orig, const Vector3f &dir, const Scene& scene,
-        int depth)
+        RayStats &stats)
 {
-    if (depth > scene.maxDepth) {
+    const int maxDepth = std::min(scene.maxDepth, MAX_RAY_DEPTH);
+    if (maxDepth < 0) {
         return Vector3f(0.0,0.0,0.0);
     }
 
-    Vector3f hitColor = scene.backgroundColor;
-    if (auto payload = trace(orig, dir, scene.get_objects()); payload)
+    RayStack stack;
+    stack.tasks.Push(RayTask::Trace(orig, dir, 0, 1.0f));
+    while (!stack.tasks.Empty())
     {
-        Vector3f hitPoint = orig + dir * payload->tNear;
-        Vector3f N; // normal
-        Vector2f st; // st coordinates
-        payload->hit_obj->getSurfaceProperties(hitPoint, dir, payload->index, payload->uv, N, st);
-        switch (payload->hit_obj->materialType) {
-            case REFLECTION_AND_REFRACTION:
-            {
-                Vector3f reflectionDirection = normalize(reflect(dir, N));
-                Vector3f refractionDirection = normalize(refract(dir, N, payload->hit_obj->ior));
-                Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0) ?
-                                             hitPoint - N * scene.epsilon :
-                                             hitPoint + N * scene.epsilon;
-                Vector3f refractionRayOrig = (dotProduct(refractionDirection, N) < 0) ?
-                                             hitPoint - N * scene.epsilon :
-                                             hitPoint + N * scene.epsilon;
-                Vector3f reflectionColor = castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1);
-                Vector3f refractionColor = castRay(refractionRayOrig, refractionDirection, scene, depth + 1);
-                float kr = fresnel(dir, N, payload->hit_obj->ior);
-                hitColor = reflectionColor * kr + refractionColor * (1 - kr);
+        const RayTask task = stack.tasks.Pop();
+        switch (task.kind) {
+            case RayTask::TRACE:
+                ++(task.depth == 0 ? stats.primaryRays : stats.secondaryRays);
+                shade(task, trace(task.orig, task.dir, scene), scene, maxDepth, stack, stats);
                 break;
-            }
-            case REFLECTION:
-            {
-                float kr = fresnel(dir, N, payload->hit_obj->ior);
-                Vector3f reflectionDirection = reflect(dir, N);
-                Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0) ?
-                                             hitPoint + N * scene.epsilon :
-                                             hitPoint - N * scene.epsilon;
-                hitColor = castRay(reflectionRayOrig, reflectionDirection, scene, depth + 1) * kr;
+            case RayTask::SKIP:
+                stack.colors.Push(Vector3f(0.0,0.0,0.0));
                 break;
-            }
-            default:
+            case RayTask::MIX:
             {
-                // [comment]
-                // We use the Phong illumation model int the default case. The phong model
-                // is composed of a diffuse and a specular reflection component.
-                // [/comment]
-                Vector3f lightAmt = 0, specularColor = 0;
-                Vector3f shadowPointOrig = (dotProduct(dir, N) < 0) ?
-                                           hitPoint + N * scene.epsilon :
-                                           hitPoint - N * scene.epsilon;
-                // [comment]
-                // Loop over all lights in the scene and sum their contribution up
-                // We also apply the lambert cosine law
-                // [/comment]
-                for (auto& light : scene.get_lights()) {
-                    Vector3f lightDir = light->position - hitPoint;
-                    // square of the distance between hitPoint and the light
-                    float lightDistance2 = dotProduct(lightDir, lightDir);
-                    lightDir = normalize(lightDir);
-                    float LdotN = std::max(0.f, dotProduct(lightDir, N));
-                    // is the point in shadow, and is the nearest occluding object closer to the object than the light itself?
-                    auto shadow_res = trace(shadowPointOrig, lightDir, scene.get_objects());
-                    bool inShadow = shadow_res && (shadow_res->tNear * shadow_res->tNear < lightDistance2);
-
-                    lightAmt += inShadow ? 0 : light->intensity * LdotN;
-                    Vector3f reflectionDirection = reflect(-lightDir, N);
-
-                    specularColor += powf(std::max(0.f, -dotProduct(reflectionDirection, dir)),
-                        payload->hit_obj->specularExponent) * light->intensity;
-                }
-
-                hitColor = lightAmt * payload->hit_obj->evalDiffuseColor(st) * payload->hit_obj->Kd + specularColor * payload->hit_obj->Ks;
+                Vector3f refractionColor = stack.colors.Pop();
+                Vector3f reflectionColor = stack.colors.Pop();
+                stack.colors.Push(reflectionColor * task.kr + refractionColor * (1 - task.kr));
                 break;
             }
+            case RayTask::SCALE:
+                stack.colors.Push(stack.colors.Pop() * task.kr);
+                break;
         }
     }
 
-    return hitColor;
+    return stack.colors.Pop();
 }
 
 // [comment]
 // The main render function. This where we iterate over all pixels in the image, generate
 // primary rays and cast these rays into the scene. The content of the framebuffer is
 // saved to a file.
+//
+// Pixels are traced in tiles on a pool of threads, see TileScheduler. Every pixel only
+// depends on its own primary ray, so the image is the same for any number of threads.
 // [/comment]
 void Renderer::Render(const Scene& scene)
 {
@@ -219,24 +376,52 @@ void Renderer::Render(const Scene& scene)
 
     // Use this variable as the eye position to start your rays.
     Vector3f eye_pos(0);
-    int m = 0;
-    for (int j = 0; j < scene.height; ++j)
+
+    // Every tile counts its rays on its own and adds them to the total when it's done.
+    stats = {};
+    std::mutex statsMutex;
+
+    auto renderTile = [&](const TileScheduler::Tile& tile)
     {
-        for (int i = 0; i < scene.width; ++i)
+        RayStats tileStats;
+        for (int j = tile.y0; j < tile.y1; ++j)
         {
-            // generate primary ray direction
-            float x = 0.0f;
-            float y = 0.0f;
-            // TODO: Find the x and y positions of the current pixel to get the direction
-            // vector that passes through it.
-            // Also, don't forget to multiply both of them with the variable *scale*, and
-            // x (horizontal) variable with the *imageAspectRatio*            
-
-            Vector3f dir = Vector3f(x, y, -1); // Don't forget to normalize this direction!
-            framebuffer[m++] = castRay(eye_pos, dir, scene, 0);
+            for (int i = tile.x0; i < tile.x1; ++i)
+            {
+                // generate primary ray direction
+                float x = 0.0f;
+                float y = 0.0f;
+                // TODO: Find the x and y positions of the current pixel to get the direction
+                // vector that passes through it.
+                // Also, don't forget to multiply both of them with the variable *scale*, and
+                // x (horizontal) variable with the *imageAspectRatio*            
+
+                Vector3f dir = Vector3f(x, y, -1); // Don't forget to normalize this direction!
+                framebuffer[j * scene.width + i] = castRay(eye_pos, dir, scene, tileStats);
+            }
         }
-        UpdateProgress(j / (float)scene.height);
-    }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats += tileStats;
+    };
+
+    // Only redraw the bar when the percentage changes.
+    int shownPercent = -1;
+    auto progress = [&](int done, int total)
+    {
+        const int percent = done * 100 / total;
+        if (percent != shownPercent)
+        {
+            shownPercent = percent;
+            UpdateProgress(done / (float)total);
+        }
+    };
+
+    TileScheduler(scene.width, scene.height, tileSize).Run(threadCount, renderTile, progress);
+
+    std::cout << "\nRays: " << stats.Total() << " (" << stats.primaryRays << " primary, "
+              << stats.secondaryRays << " reflection/refraction, " << stats.shadowRays << " shadow), "
+              << stats.prunedRays << " pruned\n";
 
     // save framebuffer to file
     std::string outputPath = Utils::PathFromAsset("output/assigment5.ppm");
@@ -1,6 +1,8 @@
 #pragma once
 #include "Scene.hpp"
 
+#include <cstdint>
+
 struct hit_payload
 {
     float tNear;
@@ -9,10 +11,40 @@ struct hit_payload
     Object* hit_obj;
 };
 
+// Rays cast for one image.
+struct RayStats
+{
+    uint64_t primaryRays = 0;
+    // Reflection and refraction rays.
+    uint64_t secondaryRays = 0;
+    uint64_t shadowRays = 0;
+    // Reflection and refraction rays skipped for a path weight below Scene::minPathWeight.
+    uint64_t prunedRays = 0;
+
+    uint64_t Total() const { return primaryRays + secondaryRays + shadowRays; }
+
+    RayStats& operator+=(const RayStats& other)
+    {
+        primaryRays += other.primaryRays;
+        secondaryRays += other.secondaryRays;
+        shadowRays += other.shadowRays;
+        prunedRays += other.prunedRays;
+        return *this;
+    }
+};
+
 class Renderer
 {
 public:
     void Render(const Scene& scene);
 
+    // Worker threads for Render, 0 uses one per hardware thread.
+    int threadCount = 0;
+    // Edge length in pixels of the tiles the workers take at a time.
+    int tileSize = 16;
+
+    // Filled in by Render.
+    RayStats stats;
+
 private:
 };
\ No newline at end of file
@@ -3,3 +3,12 @@
 //
 
 #include "Scene.hpp"
+
+void Scene::buildBVH()
+{
+    std::vector<Bounds3> bounds;
+    bounds.reserve(objects.size());
+    for (const auto& object : objects)
+        bounds.push_back(object->getBounds());
+    bvh = BVH(bounds);
+}
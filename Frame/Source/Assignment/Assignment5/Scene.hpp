@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <memory>
+#include "BVH.hpp"
 #include "Vector.hpp"
 #include "Object.hpp"
 #include "Light.hpp"
@@ -14,20 +15,31 @@ public:
     int height = 960;
     double fov = 90;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
+    // Deepest reflection or refraction followed, at most 16.
     int maxDepth = 5;
+    // Reflection and refraction rays whose path weight, the product of the Fresnel factors along the way,
+    // falls below this aren't cast. 0 casts every ray up to maxDepth.
+    float minPathWeight = 0.001f;
     float epsilon = 0.00001;
 
     Scene(int w, int h) : width(w), height(h)
     {}
 
-    void Add(std::unique_ptr<Object> object) { objects.push_back(std::move(object)); }
+    // Adding an object drops the BVH, rebuild it with buildBVH before rendering.
+    void Add(std::unique_ptr<Object> object) { objects.push_back(std::move(object)); bvh = BVH(); }
     void Add(std::unique_ptr<Light> light) { lights.push_back(std::move(light)); }
 
+    // Builds the BVH over the bounds of all objects, primitive i is get_objects()[i].
+    void buildBVH();
+
     [[nodiscard]] const std::vector<std::unique_ptr<Object> >& get_objects() const { return objects; }
     [[nodiscard]] const std::vector<std::unique_ptr<Light> >&  get_lights() const { return lights; }
+    // Empty until buildBVH is called.
+    [[nodiscard]] const BVH& get_bvh() const { return bvh; }
 
 private:
     // creating the scene (adding objects and lights)
     std::vector<std::unique_ptr<Object> > objects;
     std::vector<std::unique_ptr<Light> > lights;
+    BVH bvh;
 };
\ No newline at end of file
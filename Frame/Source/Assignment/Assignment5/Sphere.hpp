@@ -37,6 +37,11 @@ public:
         N = normalize(P - center);
     }
 
+    Bounds3 getBounds() const override
+    {
+        return Bounds3(center - Vector3f(radius), center + Vector3f(radius));
+    }
+
     Vector3f center;
     float radius, radius2;
 };
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Splits an image into square tiles and hands them to a pool of worker threads.
+//
+// Tiles are sorted in Morton order and every worker starts on an equal, contiguous share of the list, so it
+// mostly renders tiles that are close together on screen. A worker whose share is done steals single tiles
+// from the end of the other shares, which keeps all threads busy when parts of the image take longer.
+class TileScheduler
+{
+public:
+    struct Tile
+    {
+        int x0, y0, x1, y1;
+    };
+
+    TileScheduler(int width, int height, int tileSize)
+    {
+        const int tilesX = (width + tileSize - 1) / tileSize;
+        const int tilesY = (height + tileSize - 1) / tileSize;
+        for (int ty = 0; ty < tilesY; ++ty)
+        {
+            for (int tx = 0; tx < tilesX; ++tx)
+                tiles.push_back({tx * tileSize, ty * tileSize, std::min(width, (tx + 1) * tileSize), std::min(height, (ty + 1) * tileSize)});
+        }
+        std::sort(tiles.begin(), tiles.end(), [tileSize](const Tile& a, const Tile& b)
+        {
+            return Morton(a.x0 / tileSize, a.y0 / tileSize) < Morton(b.x0 / tileSize, b.y0 / tileSize);
+        });
+    }
+
+    const std::vector<Tile>& Tiles() const { return tiles; }
+
+    // Calls render(tile) once for every tile on threadCount threads, the calling thread included. 0 uses one
+    // per hardware thread. The calling thread also reports progress(done, total) after each of its tiles.
+    template <typename RenderTile, typename Progress>
+    void Run(int threadCount, const RenderTile& render, const Progress& progress) const
+    {
+        if (threadCount <= 0)
+            threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+        const int workers = std::max(1, std::min(threadCount, (int)tiles.size()));
+        const int total = (int)tiles.size();
+
+        // Remaining tiles of each worker's share as [begin, end), packed in one word so owner and thieves
+        // can both take a tile with a single compare and swap.
+        std::vector<std::atomic<uint64_t>> shares(workers);
+        for (int i = 0; i < workers; ++i)
+            shares[i] = Pack((uint32_t)(total * (int64_t)i / workers), (uint32_t)(total * (int64_t)(i + 1) / workers));
+        std::atomic<int> done = 0;
+
+        auto work = [&](int worker)
+        {
+            for (;;)
+            {
+                int tile = Take(shares[worker], true);
+                for (int k = 1; k < workers && tile < 0; ++k)
+                    tile = Take(shares[(worker + k) % workers], false);
+                if (tile < 0)
+                    return;
+
+                render(tiles[tile]);
+                const int finished = done.fetch_add(1, std::memory_order_relaxed) + 1;
+                if (worker == 0)
+                    progress(finished, total);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < workers; ++i)
+            pool.emplace_back(work, i);
+        work(0);
+        for (auto& thread : pool)
+            thread.join();
+        progress(total, total);
+    }
+
+private:
+    static uint64_t Pack(uint32_t begin, uint32_t end) { return begin | (uint64_t)end << 32; }
+
+    // Takes the first tile of a share for its owner or the last one for a thief, -1 if it's empty.
+    static int Take(std::atomic<uint64_t>& share, bool front)
+    {
+        uint64_t range = share.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const uint32_t begin = (uint32_t)range, end = (uint32_t)(range >> 32);
+            if (begin >= end)
+                return -1;
+            const uint64_t rest = front ? Pack(begin + 1, end) : Pack(begin, end - 1);
+            if (share.compare_exchange_weak(range, rest, std::memory_order_relaxed))
+                return front ? (int)begin : (int)end - 1;
+        }
+    }
+
+    // Interleaves the bits of x and y.
+    static uint32_t Morton(uint32_t x, uint32_t y)
+    {
+        auto spread = [](uint32_t v)
+        {
+            v &= 0xffff;
+            v = (v | (v << 8)) & 0x00ff00ff;
+            v = (v | (v << 4)) & 0x0f0f0f0f;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+
+    std::vector<Tile> tiles;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "BVH.hpp"
 #include "Object.hpp"
 
 #include <cstring>
@@ -31,31 +32,53 @@ public:
         numTriangles = numTris;
         stCoordinates = std::unique_ptr<Vector2f[]>(new Vector2f[maxIndex]);
         memcpy(stCoordinates.get(), st, sizeof(Vector2f) * maxIndex);
+
+        std::vector<Bounds3> triangleBounds(numTriangles);
+        for (uint32_t k = 0; k < numTriangles; ++k)
+            triangleBounds[k] = Union(Bounds3(vertices[vertexIndex[k * 3]], vertices[vertexIndex[k * 3 + 1]]),
+                                      vertices[vertexIndex[k * 3 + 2]]);
+        bvh = BVH(triangleBounds);
     }
 
     bool intersect(const Vector3f& orig, const Vector3f& dir, float& tnear, uint32_t& index,
                    Vector2f& uv) const override
     {
         bool intersect = false;
-        for (uint32_t k = 0; k < numTriangles; ++k)
+        bvh.Intersect(orig, dir, tnear, [&](uint32_t k, float& tMax)
         {
             const Vector3f& v0 = vertices[vertexIndex[k * 3]];
             const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
             const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
             float t, u, v;
-            if (rayTriangleIntersect(v0, v1, v2, orig, dir, t, u, v) && t < tnear)
+            // On a tie the lower triangle index wins, as if they were tested in order.
+            if (rayTriangleIntersect(v0, v1, v2, orig, dir, t, u, v) &&
+                (t < tMax || (t == tMax && intersect && k < index)))
             {
+                tMax = t;
                 tnear = t;
                 uv.x = u;
                 uv.y = v;
                 index = k;
                 intersect |= true;
             }
-        }
+        });
 
         return intersect;
     }
 
+    // Stops at the first triangle closer than tMax instead of looking for the closest one.
+    bool intersectP(const Vector3f& orig, const Vector3f& dir, float tMax) const override
+    {
+        return bvh.IntersectP(orig, dir, tMax, [&](uint32_t k)
+        {
+            const Vector3f& v0 = vertices[vertexIndex[k * 3]];
+            const Vector3f& v1 = vertices[vertexIndex[k * 3 + 1]];
+            const Vector3f& v2 = vertices[vertexIndex[k * 3 + 2]];
+            float t, u, v;
+            return rayTriangleIntersect(v0, v1, v2, orig, dir, t, u, v) && t < tMax;
+        });
+    }
+
     void getSurfaceProperties(const Vector3f&, const Vector3f&, const uint32_t& index, const Vector2f& uv, Vector3f& N,
                               Vector2f& st) const override
     {
@@ -71,6 +94,8 @@ public:
         st = st0 * (1 - uv.x - uv.y) + st1 * uv.x + st2 * uv.y;
     }
 
+    Bounds3 getBounds() const override { return bvh.WorldBound(); }
+
     Vector3f evalDiffuseColor(const Vector2f& st) const override
     {
         float scale = 5;
@@ -82,4 +107,6 @@ public:
     uint32_t numTriangles;
     std::unique_ptr<uint32_t[]> vertexIndex;
     std::unique_ptr<Vector2f[]> stCoordinates;
+    // Over the triangles, primitive k is triangle k.
+    BVH bvh;
 };
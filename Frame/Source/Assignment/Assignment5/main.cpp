@@ -32,6 +32,8 @@ int main()
     scene.Add(std::make_unique<Light>(Vector3f(-20, 70, 20), 0.5));
     scene.Add(std::make_unique<Light>(Vector3f(30, 50, -12), 0.5));    
 
+    scene.buildBVH();
+
     Renderer r;
     r.Render(scene);
 
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+
+// Stack with its storage inline and a capacity fixed at compile time, it never allocates.
+template <typename T, size_t Capacity>
+class FixedStack
+{
+public:
+    void Push(const T& item)
+    {
+        assert(size < Capacity);
+        items[size++] = item;
+    }
+
+    T Pop()
+    {
+        assert(size > 0);
+        return items[--size];
+    }
+
+    bool Empty() const { return size == 0; }
+    size_t Size() const { return size; }
+
+private:
+    std::array<T, Capacity> items;
+    size_t size = 0;
+};
@@ -11,6 +11,11 @@
 #include <string>
 #include <fstream>
 #include <math.h>
+#include <cstring>
+#include <unordered_map>
+#include <array>
+#include <algorithm>
+#include <set>
 
 // Print progress to console while loading (large models)
 //#define OBJL_CONSOLE_OUTPUT
@@ -211,6 +216,59 @@ namespace objl
         std::optional<Material> MeshMaterial;
     };
 
+    // Structure: VertexWelder
+    //
+    // Description: Looks up vertices by value so that
+    //	every distinct vertex is stored once
+    struct VertexWelder
+    {
+        // Index of the vertex equal to v in oVerts,
+        //	v is appended if there is none yet
+        unsigned int Add(std::vector<Vertex>& oVerts, const Vertex& v)
+        {
+            bool added;
+            unsigned int index = Add(v, added);
+            if (added)
+                oVerts.push_back(v);
+            return index;
+        }
+
+        // Same for vertices kept elsewhere: index of the vertex
+        //	equal to v in the order they were added, added tells
+        //	whether v is a new one
+        unsigned int Add(const Vertex& v, bool& added)
+        {
+            Key key;
+            std::memcpy(key.data(), &v, sizeof(Vertex));
+            auto found = Indices.try_emplace(key, (unsigned int)Indices.size());
+            added = found.second;
+            return found.first->second;
+        }
+
+        // Forget all vertices, for the next mesh
+        void Clear()
+        {
+            Indices.clear();
+        }
+
+    private:
+        // Bitwise copy of a Vertex
+        using Key = std::array<unsigned int, sizeof(Vertex) / sizeof(unsigned int)>;
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const
+            {
+                size_t h = 0xcbf29ce484222325ull;
+                for (unsigned int word : key)
+                    h = (h ^ word) * 0x100000001b3ull;
+                return h ^ (h >> 32);
+            }
+        };
+
+        std::unordered_map<Key, unsigned int, KeyHash> Indices;
+    };
+
     // Namespace: Math
     //
     // Description: The namespace that holds all of the math
@@ -313,6 +371,422 @@ namespace objl
                 return false;
         }
 
+        // Twice the signed area of a 2D triangle, positive if a b c
+        //	turn counter clockwise
+        float Cross2(const Vector2& a, const Vector2& b, const Vector2& c)
+        {
+            return (b.X - a.X) * (c.Y - a.Y) - (b.Y - a.Y) * (c.X - a.X);
+        }
+
+        // Triangulate a counter clockwise polygon by ear clipping
+        //
+        // Only reflex vertices can lie inside an ear. They are bucketed
+        //	in a grid with about one per cell, so an ear test only looks
+        //	at those near the ear instead of every vertex. The walk skips
+        //	a vertex after each clip, which avoids long fans of thin
+        //	triangles. Triangles keep the order of the polygon's vertices
+        void EarClip(std::vector<unsigned int>& oIndices, const std::vector<Vector2>& points)
+        {
+            const int n = int(points.size());
+            std::vector<int> prev(n), next(n);
+            std::vector<char> reflex(n);
+            for (int i = 0; i < n; i++)
+            {
+                prev[i] = i == 0 ? n - 1 : i - 1;
+                next[i] = i == n - 1 ? 0 : i + 1;
+            }
+
+            int reflexCount = 0;
+            Vector2 lo(INFINITY, INFINITY), hi(-INFINITY, -INFINITY);
+            for (int i = 0; i < n; i++)
+            {
+                reflex[i] = Cross2(points[prev[i]], points[i], points[next[i]]) < 0;
+                if (!reflex[i])
+                    continue;
+                reflexCount++;
+                lo = Vector2(std::min(lo.X, points[i].X), std::min(lo.Y, points[i].Y));
+                hi = Vector2(std::max(hi.X, points[i].X), std::max(hi.Y, points[i].Y));
+            }
+
+            // Reflex vertices sorted by cell, cellStart[c] is the first of cell c
+            const int side = std::max(1, int(sqrt(float(reflexCount))));
+            const float scaleX = hi.X > lo.X ? side / (hi.X - lo.X) : 0.0f;
+            const float scaleY = hi.Y > lo.Y ? side / (hi.Y - lo.Y) : 0.0f;
+            auto cellX = [&](float x) { return std::clamp(int((x - lo.X) * scaleX), 0, side - 1); };
+            auto cellY = [&](float y) { return std::clamp(int((y - lo.Y) * scaleY), 0, side - 1); };
+
+            std::vector<int> cellStart(side * side + 1, 0);
+            std::vector<int> cellItems(reflexCount);
+            for (int i = 0; i < n; i++)
+            {
+                if (reflex[i])
+                    cellStart[cellY(points[i].Y) * side + cellX(points[i].X) + 1]++;
+            }
+            for (int c = 0; c < side * side; c++)
+                cellStart[c + 1] += cellStart[c];
+            std::vector<int> cellFill(cellStart.begin(), cellStart.end() - 1);
+            for (int i = 0; i < n; i++)
+            {
+                if (reflex[i])
+                    cellItems[cellFill[cellY(points[i].Y) * side + cellX(points[i].X)]++] = i;
+            }
+
+            // strict rejects zero area ears, which are only clipped
+            //	once no proper ear is left
+            auto isEar = [&](int i, bool strict)
+            {
+                const int a = prev[i], c = next[i];
+                const Vector2& pa = points[a];
+                const Vector2& pi = points[i];
+                const Vector2& pc = points[c];
+                const float area = Cross2(pa, pi, pc);
+                if (area < 0 || (strict && area == 0))
+                    return false;
+
+                const int x0 = cellX(std::min({pa.X, pi.X, pc.X})), x1 = cellX(std::max({pa.X, pi.X, pc.X}));
+                const int y0 = cellY(std::min({pa.Y, pi.Y, pc.Y})), y1 = cellY(std::max({pa.Y, pi.Y, pc.Y}));
+                for (int y = y0; y <= y1 && reflexCount > 0; y++)
+                {
+                    for (int k = cellStart[y * side + x0]; k < cellStart[y * side + x1 + 1]; k++)
+                    {
+                        // Vertices turn convex as ears are clipped next to them, never back
+                        const int j = cellItems[k];
+                        if (!reflex[j] || j == a || j == i || j == c)
+                            continue;
+                        const Vector2& p = points[j];
+                        if (p == pa || p == pi || p == pc)
+                            continue;
+                        if (Cross2(pa, pi, p) >= 0 && Cross2(pi, pc, p) >= 0 && Cross2(pc, pa, p) >= 0)
+                            return false;
+                    }
+                }
+                return true;
+            };
+
+            int remaining = n;
+            int i = 0;
+            // Vertices tested since the last clip
+            int tested = 0;
+            while (remaining > 3)
+            {
+                // A self intersecting polygon can run out of ears,
+                //	then any vertex is clipped so it still ends
+                if (isEar(i, tested < remaining) || tested >= 2 * remaining)
+                {
+                    const int a = prev[i], c = next[i];
+                    oIndices.push_back(a);
+                    oIndices.push_back(i);
+                    oIndices.push_back(c);
+
+                    next[a] = c;
+                    prev[c] = a;
+                    reflex[i] = false;
+                    for (int j : {a, c})
+                    {
+                        if (reflex[j])
+                            reflex[j] = Cross2(points[prev[j]], points[j], points[next[j]]) < 0;
+                    }
+
+                    remaining--;
+                    tested = 0;
+                    i = next[c];
+                }
+                else
+                {
+                    i = next[i];
+                    tested++;
+                }
+            }
+            oIndices.push_back(prev[i]);
+            oIndices.push_back(i);
+            oIndices.push_back(next[i]);
+        }
+
+        // Triangulate a counter clockwise polygon in O(n log n)
+        //
+        // A sweep from the top adds diagonals at split and merge
+        //	vertices, which cuts the polygon into pieces that are
+        //	monotone in y. Each piece is triangulated along its two
+        //	chains with a stack. Returns false and leaves oIndices as
+        //	it was if the result doesn't cover the polygon, which
+        //	happens for polygons that aren't simple
+        bool MonotoneTriangulate(std::vector<unsigned int>& oIndices, const std::vector<Vector2>& points)
+        {
+            const int n = int(points.size());
+            const size_t firstIndex = oIndices.size();
+            auto nextOf = [&](int i) { return i == n - 1 ? 0 : i + 1; };
+            auto prevOf = [&](int i) { return i == 0 ? n - 1 : i - 1; };
+            // Sweep order, ties in y go from left to right
+            auto above = [&](int a, int b)
+            {
+                return points[a].Y > points[b].Y || (points[a].Y == points[b].Y && points[a].X < points[b].X);
+            };
+
+            enum VertexType { Start, End, Split, Merge, Regular };
+            std::vector<VertexType> type(n);
+            std::vector<int> order(n);
+            for (int v = 0; v < n; v++)
+            {
+                const int p = prevOf(v), q = nextOf(v);
+                const bool convex = Cross2(points[p], points[v], points[q]) > 0;
+                if (above(v, p) && above(v, q))
+                    type[v] = convex ? Start : Split;
+                else if (above(p, v) && above(q, v))
+                    type[v] = convex ? End : Merge;
+                else
+                    type[v] = Regular;
+                order[v] = v;
+            }
+            std::sort(order.begin(), order.end(), above);
+
+            // Edge e runs from vertex e to the next one. The sweep keeps the
+            //	edges with the interior on their right, ordered by x where
+            //	they cross the sweep line. Edge -1 stands for the vertex at
+            //	the sweep line, sorted after edges through it
+            double sweepY = 0, sweepX = 0;
+            auto edgeX = [&](int e)
+            {
+                if (e < 0)
+                    return sweepX;
+                const Vector2& a = points[e];
+                const Vector2& b = points[nextOf(e)];
+                if (a.Y == b.Y)
+                    return double(std::min(a.X, b.X));
+                return a.X + (sweepY - a.Y) * (double(b.X) - a.X) / (double(b.Y) - a.Y);
+            };
+            auto edgeLess = [&](int a, int b)
+            {
+                const double xa = edgeX(a), xb = edgeX(b);
+                if (xa != xb)
+                    return xa < xb;
+                return (a < 0 ? n : a) < (b < 0 ? n : b);
+            };
+            using Status = std::set<int, decltype(edgeLess)>;
+            Status status(edgeLess);
+            std::vector<Status::iterator> entry(n);
+            std::vector<char> inStatus(n, 0);
+            // Lowest vertex so far between each edge and the next one to its right
+            std::vector<int> helper(n, -1);
+            std::vector<std::pair<int, int>> diagonals;
+
+            auto insertEdge = [&](int e, int v)
+            {
+                entry[e] = status.insert(e).first;
+                inStatus[e] = 1;
+                helper[e] = v;
+            };
+            // The edge ending at v, linked to its helper if that's a merge vertex
+            auto closeEdge = [&](int v)
+            {
+                const int e = prevOf(v);
+                if (!inStatus[e])
+                    return false;
+                if (type[helper[e]] == Merge)
+                    diagonals.emplace_back(v, helper[e]);
+                status.erase(entry[e]);
+                inStatus[e] = 0;
+                return true;
+            };
+            // The edge left of v, which gets v as its helper
+            auto passLeftEdge = [&](int v, bool always)
+            {
+                sweepX = points[v].X;
+                auto it = status.upper_bound(-1);
+                if (it == status.begin())
+                    return false;
+                const int e = *--it;
+                if (always || type[helper[e]] == Merge)
+                    diagonals.emplace_back(v, helper[e]);
+                helper[e] = v;
+                return true;
+            };
+
+            for (int v : order)
+            {
+                sweepY = points[v].Y;
+                bool ok = true;
+                switch (type[v])
+                {
+                    case Start:
+                        insertEdge(v, v);
+                        break;
+                    case End:
+                        ok = closeEdge(v);
+                        break;
+                    case Split:
+                        ok = passLeftEdge(v, true);
+                        insertEdge(v, v);
+                        break;
+                    case Merge:
+                        ok = closeEdge(v) && passLeftEdge(v, false);
+                        break;
+                    case Regular:
+                        // On a left boundary the polygon continues downwards
+                        if (above(prevOf(v), v))
+                        {
+                            ok = closeEdge(v);
+                            insertEdge(v, v);
+                        }
+                        else
+                        {
+                            ok = passLeftEdge(v, false);
+                        }
+                        break;
+                }
+                if (!ok)
+                    return false;
+            }
+
+            // Half edges leaving each vertex, the polygon edge and the
+            //	diagonals, in counter clockwise order around it
+            std::vector<int> outStart(n + 1, 0);
+            for (int v = 0; v < n; v++)
+                outStart[v + 1] = 1;
+            for (const auto& d : diagonals)
+            {
+                outStart[d.first + 1]++;
+                outStart[d.second + 1]++;
+            }
+            for (int v = 0; v < n; v++)
+                outStart[v + 1] += outStart[v];
+            std::vector<int> outTo(outStart[n]);
+            std::vector<int> outFill(outStart.begin(), outStart.end() - 1);
+            for (int v = 0; v < n; v++)
+                outTo[outFill[v]++] = nextOf(v);
+            for (const auto& d : diagonals)
+            {
+                outTo[outFill[d.first]++] = d.second;
+                outTo[outFill[d.second]++] = d.first;
+            }
+            auto angle = [&](int from, int to) { return atan2(points[to].Y - points[from].Y, points[to].X - points[from].X); };
+            for (int v = 0; v < n; v++)
+            {
+                if (outStart[v + 1] - outStart[v] > 1)
+                    std::sort(outTo.begin() + outStart[v], outTo.begin() + outStart[v + 1],
+                              [&](int a, int b) { return angle(v, a) < angle(v, b); });
+            }
+
+            // Walks each piece counter clockwise, turning as far right as
+            //	possible at every vertex
+            auto nextHalfEdge = [&](int from, int at)
+            {
+                const float back = angle(at, from);
+                int pick = outStart[at + 1] - 1;
+                for (int h = outStart[at]; h < outStart[at + 1]; h++)
+                {
+                    if (angle(at, outTo[h]) < back)
+                        pick = h;
+                }
+                return pick;
+            };
+
+            std::vector<char> used(outTo.size(), 0);
+            std::vector<int> outFrom(outTo.size());
+            for (int v = 0; v < n; v++)
+                std::fill(outFrom.begin() + outStart[v], outFrom.begin() + outStart[v + 1], v);
+
+            std::vector<int> piece, left, right, stack;
+            std::vector<std::pair<int, bool>> sorted;
+            auto addTriangle = [&](int a, int b, int c)
+            {
+                if (Cross2(points[a], points[b], points[c]) < 0)
+                    std::swap(b, c);
+                oIndices.push_back(a);
+                oIndices.push_back(b);
+                oIndices.push_back(c);
+            };
+
+            for (int first = 0; first < int(outTo.size()); first++)
+            {
+                if (used[first])
+                    continue;
+                piece.clear();
+                for (int h = first; !used[h]; h = nextHalfEdge(outFrom[h], outTo[h]))
+                {
+                    used[h] = 1;
+                    piece.push_back(outFrom[h]);
+                }
+                const int k = int(piece.size());
+                if (k < 3)
+                {
+                    oIndices.resize(firstIndex);
+                    return false;
+                }
+
+                // Left chain runs counter clockwise from the top, the right
+                //	one clockwise, both down to the bottom vertex
+                int top = 0, bottom = 0;
+                for (int i = 1; i < k; i++)
+                {
+                    if (above(piece[i], piece[top]))
+                        top = i;
+                    if (above(piece[bottom], piece[i]))
+                        bottom = i;
+                }
+                left.clear();
+                right.clear();
+                for (int i = top; i != bottom; i = (i + 1) % k)
+                    left.push_back(piece[i]);
+                for (int i = (top + k - 1) % k; i != bottom; i = (i + k - 1) % k)
+                    right.push_back(piece[i]);
+
+                sorted.clear();
+                size_t l = 0, r = 0;
+                while (l < left.size() || r < right.size())
+                {
+                    if (r == right.size() || (l < left.size() && above(left[l], right[r])))
+                        sorted.emplace_back(left[l++], true);
+                    else
+                        sorted.emplace_back(right[r++], false);
+                }
+                sorted.emplace_back(piece[bottom], true);
+
+                stack.assign({0, 1});
+                for (int j = 2; j < k - 1; j++)
+                {
+                    const auto& [u, onLeft] = sorted[j];
+                    if (onLeft != sorted[stack.back()].second)
+                    {
+                        for (size_t i = 0; i + 1 < stack.size(); i++)
+                            addTriangle(u, sorted[stack[i]].first, sorted[stack[i + 1]].first);
+                        stack.assign({j - 1, j});
+                    }
+                    else
+                    {
+                        int last = stack.back();
+                        stack.pop_back();
+                        while (!stack.empty())
+                        {
+                            const int a = sorted[stack.back()].first, b = sorted[last].first;
+                            const float turn = onLeft ? Cross2(points[a], points[b], points[u]) : Cross2(points[u], points[b], points[a]);
+                            if (turn <= 0)
+                                break;
+                            addTriangle(u, b, a);
+                            last = stack.back();
+                            stack.pop_back();
+                        }
+                        stack.push_back(last);
+                        stack.push_back(j);
+                    }
+                }
+                for (size_t i = 0; i + 1 < stack.size(); i++)
+                    addTriangle(sorted[k - 1].first, sorted[stack[i]].first, sorted[stack[i + 1]].first);
+            }
+
+            // The triangles have to cover the polygon's area exactly once
+            double polygonArea = 0, triangleArea = 0;
+            for (int i = 0; i < n; i++)
+                polygonArea += Cross2(points[0], points[i], points[nextOf(i)]);
+            for (size_t i = firstIndex; i < oIndices.size(); i += 3)
+                triangleArea += Cross2(points[oIndices[i]], points[oIndices[i + 1]], points[oIndices[i + 2]]);
+            if (oIndices.size() - firstIndex != 3 * size_t(n - 2) || fabs(triangleArea - polygonArea) > 1e-4 * polygonArea)
+            {
+                oIndices.resize(firstIndex);
+                return false;
+            }
+            return true;
+        }
+
         // Split a String into a string array at a given token
         inline void split(const std::string &in,
                           std::vector<std::string> &out,
@@ -453,6 +927,7 @@ namespace objl
             std::string meshname;
 
             Mesh tempMesh;
+            VertexWelder welder;
 
 #ifdef OBJL_CONSOLE_OUTPUT
             const unsigned int outputEveryNth = 1000;
@@ -510,6 +985,7 @@ namespace objl
                             // Cleanup
                             Vertices.clear();
                             Indices.clear();
+                            welder.Clear();
                             meshname.clear();
 
                             meshname = algorithm::tail(curline);
@@ -576,27 +1052,51 @@ namespace objl
                     std::vector<Vertex> vVerts;
                     GenVerticesFromRawOBJ(vVerts, Positions, TCoords, Normals, curline);
 
-                    // Add Vertices
-                    for (int i = 0; i < int(vVerts.size()); i++)
-                    {
-                        Vertices.push_back(vVerts[i]);
-
-                        LoadedVertices.push_back(vVerts[i]);
-                    }
-
                     std::vector<unsigned int> iIndices;
 
                     VertexTriangluation(iIndices, vVerts);
 
-                    // Add Indices
-                    for (int i = 0; i < int(iIndices.size()); i++)
+                    if (WeldVertices)
                     {
-                        unsigned int indnum = (unsigned int)((Vertices.size()) - vVerts.size()) + iIndices[i];
-                        Indices.push_back(indnum);
+                        // Add only the Vertices the mesh doesn't have yet,
+                        //	Indices refer to the first equal vertex
+                        std::vector<unsigned int> welded(vVerts.size());
+                        for (int i = 0; i < int(vVerts.size()); i++)
+                        {
+                            size_t count = Vertices.size();
+                            welded[i] = welder.Add(Vertices, vVerts[i]);
+                            if (Vertices.size() != count)
+                                LoadedVertices.push_back(vVerts[i]);
+                        }
 
-                        indnum = (unsigned int)((LoadedVertices.size()) - vVerts.size()) + iIndices[i];
-                        LoadedIndices.push_back(indnum);
+                        // The mesh's vertices are the last ones in LoadedVertices
+                        unsigned int meshStart = (unsigned int)(LoadedVertices.size() - Vertices.size());
+                        for (int i = 0; i < int(iIndices.size()); i++)
+                        {
+                            Indices.push_back(welded[iIndices[i]]);
+                            LoadedIndices.push_back(meshStart + welded[iIndices[i]]);
+                        }
+                    }
+                    else
+                    {
+                        // Add Vertices
+                        for (int i = 0; i < int(vVerts.size()); i++)
+                        {
+                            Vertices.push_back(vVerts[i]);
+
+                            LoadedVertices.push_back(vVerts[i]);
+                        }
+
+                        // Add Indices
+                        for (int i = 0; i < int(iIndices.size()); i++)
+                        {
+                            unsigned int indnum = (unsigned int)((Vertices.size()) - vVerts.size()) + iIndices[i];
+                            Indices.push_back(indnum);
+
+                            indnum = (unsigned int)((LoadedVertices.size()) - vVerts.size()) + iIndices[i];
+                            LoadedIndices.push_back(indnum);
 
+                        }
                     }
                 }
                 // Get Mesh Material Name
@@ -626,6 +1126,7 @@ namespace objl
                         // Cleanup
                         Vertices.clear();
                         Indices.clear();
+                        welder.Clear();
                     }
 
 #ifdef OBJL_CONSOLE_OUTPUT
@@ -708,6 +1209,10 @@ namespace objl
             }
         }
 
+        // Store each distinct vertex of a mesh once and
+        //	index it, instead of one vertex per face corner
+        bool WeldVertices = false;
+
         // Loaded Mesh Objects
         std::vector<Mesh> LoadedMeshes;
         // Loaded Vertex Objects
@@ -829,10 +1334,11 @@ namespace objl
             }
         }
 
+    public:
         // Triangulate a list of vertices into a face by printing
         //	inducies corresponding with triangles within it
-        void VertexTriangluation(std::vector<unsigned int>& oIndices,
-                                 const std::vector<Vertex>& iVerts)
+        static void VertexTriangluation(std::vector<unsigned int>& oIndices,
+                                        const std::vector<Vertex>& iVerts)
         {
             // If there are 2 or less verts,
             // no triangle can be created,
@@ -850,152 +1356,78 @@ namespace objl
                 return;
             }
 
-            // Create a list of vertices
-            std::vector<Vertex> tVerts = iVerts;
-
-            while (true)
+            // Project onto the axis plane closest to the polygon's
+            //	plane, the normal is the sum over all edges (Newell)
+            const int n = int(iVerts.size());
+            Vector3 normal;
+            for (int i = 0; i < n; i++)
             {
-                // For every vertex
-                for (int i = 0; i < int(tVerts.size()); i++)
+                const Vector3& a = iVerts[i].Position;
+                const Vector3& b = iVerts[(i + 1) % n].Position;
+                normal.X += (a.Y - b.Y) * (a.Z + b.Z);
+                normal.Y += (a.Z - b.Z) * (a.X + b.X);
+                normal.Z += (a.X - b.X) * (a.Y + b.Y);
+            }
+            const float nx = fabs(normal.X), ny = fabs(normal.Y), nz = fabs(normal.Z);
+            // Mirrored where the normal points away, so the
+            //	projection turns counter clockwise. Repeated corners
+            //	are left out, ids has the vertex of each point
+            std::vector<Vector2> points;
+            std::vector<unsigned int> ids;
+            for (int i = 0; i < n; i++)
+            {
+                const Vector3& p = iVerts[i].Position;
+                Vector2 point;
+                if (nz >= nx && nz >= ny)
+                    point = Vector2(normal.Z < 0 ? -p.X : p.X, p.Y);
+                else if (nx >= ny)
+                    point = Vector2(normal.X < 0 ? -p.Y : p.Y, p.Z);
+                else
+                    point = Vector2(normal.Y < 0 ? -p.Z : p.Z, p.X);
+                if (points.empty() || point != points.back())
                 {
-                    // pPrev = the previous vertex in the list
-                    Vertex pPrev;
-                    if (i == 0)
-                    {
-                        pPrev = tVerts[tVerts.size() - 1];
-                    }
-                    else
-                    {
-                        pPrev = tVerts[i - 1];
-                    }
-
-                    // pCur = the current vertex;
-                    Vertex pCur = tVerts[i];
-
-                    // pNext = the next vertex in the list
-                    Vertex pNext;
-                    if (i == tVerts.size() - 1)
-                    {
-                        pNext = tVerts[0];
-                    }
-                    else
-                    {
-                        pNext = tVerts[i + 1];
-                    }
-
-                    // Check to see if there are only 3 verts left
-                    // if so this is the last triangle
-                    if (tVerts.size() == 3)
-                    {
-                        // Create a triangle from pCur, pPrev, pNext
-                        for (int j = 0; j < int(tVerts.size()); j++)
-                        {
-                            if (iVerts[j].Position == pCur.Position)
-                                oIndices.push_back(j);
-                            if (iVerts[j].Position == pPrev.Position)
-                                oIndices.push_back(j);
-                            if (iVerts[j].Position == pNext.Position)
-                                oIndices.push_back(j);
-                        }
-
-                        tVerts.clear();
-                        break;
-                    }
-                    if (tVerts.size() == 4)
-                    {
-                        // Create a triangle from pCur, pPrev, pNext
-                        for (int j = 0; j < int(iVerts.size()); j++)
-                        {
-                            if (iVerts[j].Position == pCur.Position)
-                                oIndices.push_back(j);
-                            if (iVerts[j].Position == pPrev.Position)
-                                oIndices.push_back(j);
-                            if (iVerts[j].Position == pNext.Position)
-                                oIndices.push_back(j);
-                        }
-
-                        Vector3 tempVec;
-                        for (int j = 0; j < int(tVerts.size()); j++)
-                        {
-                            if (tVerts[j].Position != pCur.Position
-                                && tVerts[j].Position != pPrev.Position
-                                && tVerts[j].Position != pNext.Position)
-                            {
-                                tempVec = tVerts[j].Position;
-                                break;
-                            }
-                        }
-
-                        // Create a triangle from pCur, pPrev, pNext
-                        for (int j = 0; j < int(iVerts.size()); j++)
-                        {
-                            if (iVerts[j].Position == pPrev.Position)
-                                oIndices.push_back(j);
-                            if (iVerts[j].Position == pNext.Position)
-                                oIndices.push_back(j);
-                            if (iVerts[j].Position == tempVec)
-                                oIndices.push_back(j);
-                        }
-
-                        tVerts.clear();
-                        break;
-                    }
-
-                    // If Vertex is not an interior vertex
-                    float angle = math::AngleBetweenV3(pPrev.Position - pCur.Position, pNext.Position - pCur.Position) * (180 / 3.14159265359);
-                    if (angle <= 0 && angle >= 180)
-                        continue;
-
-                    // If any vertices are within this triangle
-                    bool inTri = false;
-                    for (int j = 0; j < int(iVerts.size()); j++)
-                    {
-                        if (algorithm::inTriangle(iVerts[j].Position, pPrev.Position, pCur.Position, pNext.Position)
-                            && iVerts[j].Position != pPrev.Position
-                            && iVerts[j].Position != pCur.Position
-                            && iVerts[j].Position != pNext.Position)
-                        {
-                            inTri = true;
-                            break;
-                        }
-                    }
-                    if (inTri)
-                        continue;
-
-                    // Create a triangle from pCur, pPrev, pNext
-                    for (int j = 0; j < int(iVerts.size()); j++)
-                    {
-                        if (iVerts[j].Position == pCur.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pPrev.Position)
-                            oIndices.push_back(j);
-                        if (iVerts[j].Position == pNext.Position)
-                            oIndices.push_back(j);
-                    }
-
-                    // Delete pCur from the list
-                    for (int j = 0; j < int(tVerts.size()); j++)
-                    {
-                        if (tVerts[j].Position == pCur.Position)
-                        {
-                            tVerts.erase(tVerts.begin() + j);
-                            break;
-                        }
-                    }
-
-                    // reset i to the start
-                    // -1 since loop will add 1 to it
-                    i = -1;
+                    points.push_back(point);
+                    ids.push_back(i);
                 }
+            }
+            while (points.size() > 1 && points.back() == points.front())
+            {
+                points.pop_back();
+                ids.pop_back();
+            }
+            const int m = int(points.size());
+            if (m < 3)
+                return;
 
-                // if no triangles were created
-                if (oIndices.size() == 0)
-                    break;
-
-                // if no more vertices
-                if (tVerts.size() == 0)
-                    break;
+            // Convex polygons need no search, quads are split from
+            //	the last vertex and larger ones fanned from the first
+            bool convex = true;
+            for (int i = 0; i < m && convex; i++)
+                convex = algorithm::Cross2(points[i == 0 ? m - 1 : i - 1], points[i], points[(i + 1) % m]) > 0;
+            if (convex)
+            {
+                if (m == 4)
+                {
+                    for (int i : {0, 1, 3, 1, 2, 3})
+                        oIndices.push_back(ids[i]);
+                    return;
+                }
+                for (int i = 1; i + 1 < m; i++)
+                {
+                    oIndices.push_back(ids[0]);
+                    oIndices.push_back(ids[i]);
+                    oIndices.push_back(ids[i + 1]);
+                }
+                return;
             }
+
+            // Ear clipping is quick enough for small polygons and
+            //	handles those that intersect themselves
+            const size_t first = oIndices.size();
+            if (m < 64 || !algorithm::MonotoneTriangulate(oIndices, points))
+                algorithm::EarClip(oIndices, points);
+            for (size_t i = first; i < oIndices.size(); i++)
+                oIndices[i] = ids[oIndices[i]];
         }
 
         // Load Materials from .mtl file
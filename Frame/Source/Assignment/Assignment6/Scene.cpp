@@ -3,6 +3,9 @@
 //
 
 #include "Scene.hpp"
+#include "FixedStack.hpp"
+
+#include <algorithm>
 
 
 void Scene::buildBVH() {
@@ -36,25 +39,73 @@ bool Scene::trace(
     return (*hitObject != nullptr);
 }
 
+// castRay walks the ray tree with an explicit stack of tasks instead of recursion. A TRACE task is
+// a pending ray segment. Tracing it pushes either its color or, on a reflective surface, the tasks
+// for the reflected and refracted rays and a task that combines their colors once they are known.
+// Colors are combined in the same order and with the same expressions as the recursive version
+// did, so the results are bit for bit the same.
+//
+// A TRACE task doesn't depend on any color, so the TRACE tasks of one bounce could also be
+// collected across pixels and intersected as a batch before they are shaded.
+struct RayTask
+{
+    enum Kind
+    {
+        // Trace the ray from orig along dir and shade the hit.
+        TRACE,
+        // A ray past maxDepth, its color is black.
+        SKIP,
+        // Pop the refraction and reflection colors, push reflection * kr + refraction * (1 - kr).
+        MIX,
+        // Pop a color, push color * kr.
+        SCALE
+    };
+
+    Kind kind;
+    float kr;
+    Vector3f orig, dir;
+    int depth;
+
+    static RayTask Trace(const Vector3f& orig, const Vector3f& dir, int depth) { return {TRACE, 0, orig, dir, depth}; }
+    static RayTask Skip() { return {SKIP, 0, {}, {}, 0}; }
+    static RayTask Mix(float kr) { return {MIX, kr, {}, {}, 0}; }
+    static RayTask Scale(float kr) { return {SCALE, kr, {}, {}, 0}; }
+};
+
+// Deepest reflection or refraction castRay follows, a larger maxDepth is clamped to it.
+constexpr int MAX_RAY_DEPTH = 16;
+
+// Work space of castRay for one pixel. Every level of the ray tree leaves at most two tasks, a MIX
+// and the refraction ray, and one color waiting for its sibling on the stacks.
+struct RayStack
+{
+    FixedStack<RayTask, 2 * MAX_RAY_DEPTH + 3> tasks;
+    FixedStack<Vector3f, MAX_RAY_DEPTH + 2> colors;
+};
+
 // Implementation of the Whitted-syle light transport algorithm (E [S*] (D|G) L)
 //
-// This function is the function that compute the color at the intersection point
-// of a ray defined by a position and a direction. Note that thus function is recursive (it calls itself).
+// This function computes the color at the intersection point of a ray of castRay.
 //
 // If the material of the intersected object is either reflective or reflective and refractive,
-// then we compute the reflection/refracton direction and cast two new rays into the scene
-// by calling the castRay() function recursively. When the surface is transparent, we mix
-// the reflection and refraction color using the result of the fresnel equations (it computes
-// the amount of reflection and refractin depending on the surface normal, incident view direction
-// and surface refractive index).
+// then we compute the reflection/refracton direction and push the tasks for the new rays. When
+// the surface is transparent, we mix the reflection and refraction color using the result of the
+// fresnel equations (it computes the amount of reflection and refractin depending on the surface
+// normal, incident view direction and surface refractive index).
 //
 // If the surface is duffuse/glossy we use the Phong illumation model to compute the color
 // at the intersection point.
-Vector3f Scene::castRay(const Ray &ray, int depth) const
+void Scene::shadeRay(const Ray &ray, int depth, int maxDepth, RayStack &stack) const
 {
-    if (depth > this->maxDepth) {
-        return Vector3f(0.0,0.0,0.0);
-    }
+    // Follows a reflected or refracted ray, unless it's too deep.
+    auto pushSecondary = [&](const Vector3f &rayOrig, const Vector3f &rayDir)
+    {
+        if (depth + 1 > maxDepth)
+            stack.tasks.Push(RayTask::Skip());
+        else
+            stack.tasks.Push(RayTask::Trace(rayOrig, rayDir, depth + 1));
+    };
+
     Intersection intersection = Scene::intersect(ray);
     Material *m = intersection.m;
     Object *hitObject = intersection.obj;
@@ -80,12 +131,13 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const
                 Vector3f refractionRayOrig = (dotProduct(refractionDirection, N) < 0) ?
                                              hitPoint - N * EPSILON :
                                              hitPoint + N * EPSILON;
-                Vector3f reflectionColor = castRay(Ray(reflectionRayOrig, reflectionDirection), depth + 1);
-                Vector3f refractionColor = castRay(Ray(refractionRayOrig, refractionDirection), depth + 1);
                 float kr;
                 fresnel(ray.direction, N, m->ior, kr);
-                hitColor = reflectionColor * kr + refractionColor * (1 - kr);
-                break;
+                // Popped in reverse: the reflection is traced first, then the refraction, then they are mixed.
+                stack.tasks.Push(RayTask::Mix(kr));
+                pushSecondary(refractionRayOrig, refractionDirection);
+                pushSecondary(reflectionRayOrig, reflectionDirection);
+                return;
             }
             case REFLECTION:
             {
@@ -95,8 +147,9 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const
                 Vector3f reflectionRayOrig = (dotProduct(reflectionDirection, N) < 0) ?
                                              hitPoint + N * EPSILON :
                                              hitPoint - N * EPSILON;
-                hitColor = castRay(Ray(reflectionRayOrig, reflectionDirection),depth + 1) * kr;
-                break;
+                stack.tasks.Push(RayTask::Scale(kr));
+                pushSecondary(reflectionRayOrig, reflectionDirection);
+                return;
             }
             default:
             {
@@ -134,5 +187,42 @@ Vector3f Scene::castRay(const Ray &ray, int depth) const
         }
     }
 
-    return hitColor;
+    stack.colors.Push(hitColor);
+}
+
+// Computes the color seen along a ray by working through the tasks of its ray tree, see RayTask.
+// The stacks live in fixed size arrays, so a pixel never allocates.
+Vector3f Scene::castRay(const Ray &ray, int depth) const
+{
+    const int maxDepth = std::min(this->maxDepth, MAX_RAY_DEPTH);
+    if (depth > maxDepth) {
+        return Vector3f(0.0,0.0,0.0);
+    }
+
+    RayStack stack;
+    stack.tasks.Push(RayTask::Trace(ray.origin, ray.direction, depth));
+    while (!stack.tasks.Empty())
+    {
+        const RayTask task = stack.tasks.Pop();
+        switch (task.kind) {
+            case RayTask::TRACE:
+                shadeRay(Ray(task.orig, task.dir), task.depth, maxDepth, stack);
+                break;
+            case RayTask::SKIP:
+                stack.colors.Push(Vector3f(0.0,0.0,0.0));
+                break;
+            case RayTask::MIX:
+            {
+                Vector3f refractionColor = stack.colors.Pop();
+                Vector3f reflectionColor = stack.colors.Pop();
+                stack.colors.Push(reflectionColor * task.kr + refractionColor * (1 - task.kr));
+                break;
+            }
+            case RayTask::SCALE:
+                stack.colors.Push(stack.colors.Pop() * task.kr);
+                break;
+        }
+    }
+
+    return stack.colors.Pop();
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "BVH.hpp"
 #include "Ray.hpp"
 
+struct RayStack;
 
 class Scene
 {
@@ -21,6 +22,7 @@ public:
     int height = 960;
     double fov = 90;
     Vector3f backgroundColor = Vector3f(0.235294, 0.67451, 0.843137);
+    // Deepest reflection or refraction followed, at most 16.
     int maxDepth = 5;
 
     Scene(int w, int h) : width(w), height(h)
@@ -35,6 +37,8 @@ public:
     BVHAccel *bvh;
     void buildBVH();
     Vector3f castRay(const Ray &ray, int depth) const;
+    // Shades the hit of one ray of castRay, see Scene.cpp.
+    void shadeRay(const Ray &ray, int depth, int maxDepth, RayStack &stack) const;
     bool trace(const Ray &ray, const std::vector<Object*> &objects, float &tNear, uint32_t &index, Object **hitObject);
     std::tuple<Vector3f, Vector3f> HandleAreaLight(const AreaLight &light, const Vector3f &hitPoint, const Vector3f &N,
                                                    const Vector3f &shadowPointOrig,
@@ -3,7 +3,7 @@
 #include "BVH.hpp"
 #include "Intersection.hpp"
 #include "Material.hpp"
-#include "OBJ_Loader.hpp"
+#include "FastObjLoader.hpp"
 #include "Object.hpp"
 #include "Triangle.hpp"
 #include <cassert>
@@ -77,47 +77,71 @@ class MeshTriangle : public Object
 public:
     MeshTriangle(const std::string& filename)
     {
-        objl::Loader loader;
-        loader.LoadFile(filename);
-
-        assert(loader.LoadedMeshes.size() == 1);
-        auto mesh = loader.LoadedMeshes[0];
-
-        Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity(),
-                                     std::numeric_limits<float>::infinity()};
-        Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity(),
-                                     -std::numeric_limits<float>::infinity()};
-        for (int i = 0; i < mesh.Vertices.size(); i += 3) {
-            std::array<Vector3f, 3> face_vertices;
-            for (int j = 0; j < 3; j++) {
-                auto vert = Vector3f(mesh.Vertices[i + j].Position.X,
-                                     mesh.Vertices[i + j].Position.Y,
-                                     mesh.Vertices[i + j].Position.Z) *
-                            60.f;
-                face_vertices[j] = vert;
-
-                min_vert = Vector3f(std::min(min_vert.x, vert.x),
-                                    std::min(min_vert.y, vert.y),
-                                    std::min(min_vert.z, vert.z));
-                max_vert = Vector3f(std::max(max_vert.x, vert.x),
-                                    std::max(max_vert.y, vert.y),
-                                    std::max(max_vert.z, vert.z));
+        // Builds the triangles while the file is parsed, so the loader keeps no
+        // copy of the mesh.
+        struct Stream : objl::MeshStream
+        {
+            explicit Stream(MeshTriangle& mesh) : mesh(mesh) {}
+
+            void AddVertices(const objl::Vertex* verts, size_t count) override
+            {
+                for (size_t i = 0; i < count; ++i)
+                    positions.push_back(Vector3f(verts[i].Position.X,
+                                                 verts[i].Position.Y,
+                                                 verts[i].Position.Z) * 60.f);
             }
 
-            auto new_mat =
-                new Material(MaterialType::DIFFUSE_AND_GLOSSY,
-                             Vector3f(0.5, 0.5, 0.5), Vector3f(0, 0, 0));
-            new_mat->Kd = 0.6;
-            new_mat->Ks = 0.0;
-            new_mat->specularExponent = 0;
+            void AddIndices(const unsigned int* indices, size_t count) override
+            {
+                for (size_t i = 0; i + 2 < count; i += 3) {
+                    std::array<Vector3f, 3> face_vertices;
+                    for (int j = 0; j < 3; j++) {
+                        const Vector3f& vert = positions[indices[i + j]];
+                        face_vertices[j] = vert;
+
+                        min_vert = Vector3f(std::min(min_vert.x, vert.x),
+                                            std::min(min_vert.y, vert.y),
+                                            std::min(min_vert.z, vert.z));
+                        max_vert = Vector3f(std::max(max_vert.x, vert.x),
+                                            std::max(max_vert.y, vert.y),
+                                            std::max(max_vert.z, vert.z));
+                    }
+
+                    auto new_mat =
+                        new Material(MaterialType::DIFFUSE_AND_GLOSSY,
+                                     Vector3f(0.5, 0.5, 0.5), Vector3f(0, 0, 0));
+                    new_mat->Kd = 0.6;
+                    new_mat->Ks = 0.0;
+                    new_mat->specularExponent = 0;
+
+                    mesh.triangles.emplace_back(face_vertices[0], face_vertices[1],
+                                                face_vertices[2], new_mat);
+                }
+            }
 
-            triangles.emplace_back(face_vertices[0], face_vertices[1],
-                                   face_vertices[2], new_mat);
-        }
+            void EndMesh(const std::string&, const objl::Material*) override
+            {
+                positions.clear();
+                ++mesh_count;
+            }
 
-        bounding_box = Bounds3(min_vert, max_vert);
+            MeshTriangle& mesh;
+            std::vector<Vector3f> positions;
+            int mesh_count = 0;
+            Vector3f min_vert = Vector3f{std::numeric_limits<float>::infinity(),
+                                         std::numeric_limits<float>::infinity(),
+                                         std::numeric_limits<float>::infinity()};
+            Vector3f max_vert = Vector3f{-std::numeric_limits<float>::infinity(),
+                                         -std::numeric_limits<float>::infinity(),
+                                         -std::numeric_limits<float>::infinity()};
+        };
+
+        objl::FastLoader loader;
+        Stream stream(*this);
+        loader.StreamFile(filename, stream);
+        assert(stream.mesh_count == 1);
+
+        bounding_box = Bounds3(stream.min_vert, stream.max_vert);
 
         std::vector<Object*> ptrs;
         for (auto& tri : triangles)
@@ -8,6 +8,11 @@ function MakeAssignment(projectName)
 		-- SharedLib, StaticLib, ConsoleApp, Utility
 		language("C++")
 		cppdialect("C++20")
+		-- The rasterizers of Assignment2 and 3 are built for AVX2 and need a CPU which supports it.
+		-- Their Simd.hpp only falls back to SSE when compiled without AVX2, the other assignments keep the default.
+		if projectName == "Assignment2" or projectName == "Assignment3" then
+			vectorextensions("AVX2")
+		end
 		
 		-- Intermediate and binary path.
 		location(IntermediatePath)